@@ -0,0 +1,565 @@
+/* Streaming Aggregation of Debug Text
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// For long soak tests, the raw debug text is mostly noise.  In this
+// mode, the text is cut into lines and each line is reduced to a
+// message type and a few numeric fields, and only periodic summaries
+// are printed: the total count and the recent rate of each type of
+// message, and the distribution of each numeric field since the
+// previous summary.
+//
+// A line is first tried against the templates, if a template file was
+// given.  Each template line is literal text with {name} wherever a
+// number appears, and {} to skip any text up to the next literal
+// character, for example:
+//
+//   battery {mV} mV, temp {degC}
+//   usb reset {}
+//
+// The template is the message type.  Lines matching no template are
+// scanned for key=value pairs, which become fields when the value is
+// a number.  The message type is then the line itself, with all
+// values and any other numbers replaced by '#'.
+//
+// Everything is stored in tables of fixed size, allocated once.  Message
+// types beyond the table size are counted together as "other", fields
+// beyond the per-type limit are ignored, and numbers are counted in
+// log-linear buckets (8 per power of 2, about 9% resolution), so the
+// memory used and the work per line do not depend on how much text
+// arrives or how long hid_listen runs.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include "aggregate.h"
+#include "timestamp.h"
+
+#define AGG_LINE	256	// longer lines are truncated
+#define AGG_TYPES	64	// message types, power of 2
+#define AGG_FIELDS	4	// numeric fields per message type
+#define AGG_NAME	48
+#define AGG_KEY		16
+#define AGG_TEMPLATES	32
+
+// bucket layout for numbers: 8 per power of 2 from 2^-8 to 2^40,
+// for each sign, plus one for zero (and anything smaller)
+#define SKETCH_SUB	8
+#define SKETCH_MINEXP	-8
+#define SKETCH_OCTAVES	48
+#define SKETCH_HALF	(SKETCH_SUB * SKETCH_OCTAVES)
+#define SKETCH_BUCKETS	(SKETCH_HALF * 2 + 1)
+
+struct sketch {
+	uint32_t count;
+	double min;
+	double max;
+	double sum;
+	uint32_t bucket[SKETCH_BUCKETS];
+};
+
+struct field {
+	char key[AGG_KEY];
+	struct sketch values;
+};
+
+struct msgtype {
+	uint32_t hash;		// 0 if unused
+	char name[AGG_NAME];
+	uint64_t total;
+	uint32_t interval;	// lines since the last summary
+	int nfields;
+	struct field field[AGG_FIELDS];
+};
+
+struct template {
+	char text[AGG_LINE];
+	struct msgtype *type;
+};
+
+struct aggregate_struct {
+	aggregate_output_t out;
+	uint64_t interval_ns;
+	uint64_t begin;
+	uint64_t last;		// time of the last summary
+	uint64_t next;
+	char line[AGG_LINE];
+	int linelen;
+	int overflow;
+	uint64_t lines;
+	uint64_t truncated;
+	uint64_t other_total;	// lines of types the table had no room for
+	uint32_t other_interval;
+	int ntemplates;
+	struct template template[AGG_TEMPLATES];
+	struct msgtype type[AGG_TYPES];
+};
+
+
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                    Fixed Memory Numeric Sketch                      **/
+/**                                                                     **/
+/*************************************************************************/
+
+static int sketch_index(double v)
+{
+	double m, a;
+	int e, idx;
+
+	a = fabs(v);
+	if (!(a >= ldexp(1.0, SKETCH_MINEXP))) return SKETCH_HALF;	// also NaN
+	m = frexp(a, &e);	// a = m * 2^e, 0.5 <= m < 1
+	e = e - 1 - SKETCH_MINEXP;
+	if (e >= SKETCH_OCTAVES) {
+		idx = SKETCH_HALF - 1;
+	} else {
+		idx = e * SKETCH_SUB + (int)((m * 2.0 - 1.0) * SKETCH_SUB);
+	}
+	return v < 0 ? SKETCH_HALF - 1 - idx : SKETCH_HALF + 1 + idx;
+}
+
+static double sketch_value(int idx)
+{
+	int sign = 1, e;
+	double m;
+
+	if (idx == SKETCH_HALF) return 0.0;
+	if (idx < SKETCH_HALF) {
+		sign = -1;
+		idx = SKETCH_HALF - 1 - idx;
+	} else {
+		idx -= SKETCH_HALF + 1;
+	}
+	e = idx / SKETCH_SUB + SKETCH_MINEXP;
+	m = 1.0 + ((idx % SKETCH_SUB) + 0.5) / SKETCH_SUB;
+	return sign * ldexp(m, e);
+}
+
+static void sketch_record(struct sketch *s, double v)
+{
+	s->bucket[sketch_index(v)]++;
+	if (s->count == 0 || v < s->min) s->min = v;
+	if (s->count == 0 || v > s->max) s->max = v;
+	s->sum += v;
+	s->count++;
+}
+
+static double sketch_percentile(const struct sketch *s, double percent)
+{
+	uint64_t want, seen = 0;
+	double v;
+	int i;
+
+	want = (uint64_t)(percent / 100.0 * s->count + 0.5);
+	if (want < 1) want = 1;
+	for (i=0; i < SKETCH_BUCKETS; i++) {
+		seen += s->bucket[i];
+		if (seen >= want) break;
+	}
+	if (i >= SKETCH_BUCKETS) return s->max;
+	v = sketch_value(i);
+	if (v < s->min) v = s->min;
+	if (v > s->max) v = s->max;
+	return v;
+}
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                      Message Types and Fields                       **/
+/**                                                                     **/
+/*************************************************************************/
+
+static uint32_t hash(const char *s)
+{
+	uint32_t h = 2166136261u;	// FNV-1a
+
+	while (*s) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+	return h ? h : 1;
+}
+
+static struct msgtype * find_type(struct aggregate_struct *a, const char *name)
+{
+	struct msgtype *t;
+	uint32_t h;
+	int i, n;
+
+	h = hash(name);
+	for (n=0; n < AGG_TYPES; n++) {
+		i = (h + n) & (AGG_TYPES - 1);
+		t = a->type + i;
+		if (t->hash == 0) {
+			t->hash = h;
+			strncpy(t->name, name, AGG_NAME - 1);
+			return t;
+		}
+		if (t->hash == h && strncmp(t->name, name, AGG_NAME - 1) == 0) return t;
+	}
+	return NULL;
+}
+
+static void add_field(struct msgtype *t, const char *key, int keylen, double v)
+{
+	int i;
+
+	if (keylen > AGG_KEY - 1) keylen = AGG_KEY - 1;
+	for (i=0; i < t->nfields; i++) {
+		if (strncmp(t->field[i].key, key, keylen) == 0
+		  && t->field[i].key[keylen] == 0) break;
+	}
+	if (i >= t->nfields) {
+		if (t->nfields >= AGG_FIELDS) return;
+		memcpy(t->field[i].key, key, keylen);
+		t->field[i].key[keylen] = 0;
+		t->nfields++;
+	}
+	sketch_record(&t->field[i].values, v);
+}
+
+static int is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static int is_keychar(char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+		|| is_digit(c) || c == '_' || c == '.';
+}
+
+// parse a decimal number, returns its length or 0.  Only the decimal
+// digits are given to strtod, which would also take "inf", "nan" and
+// hex, and a hex number is not taken as a 0 followed by units.
+static int number(const char *s, double *v)
+{
+	const char *p = s, *digits;
+	char tmp[64];
+	int len;
+
+	if (*p == '-' || *p == '+') p++;
+	if (!is_digit(*p) && !(*p == '.' && is_digit(p[1]))) return 0;
+	digits = p;
+	while (is_digit(*p)) p++;
+	if ((*p == 'x' || *p == 'X') && p - digits == 1 && *digits == '0') return 0;
+	if (*p == '.') {
+		p++;
+		while (is_digit(*p)) p++;
+	}
+	if ((*p == 'e' || *p == 'E') && (is_digit(p[1])
+	  || ((p[1] == '-' || p[1] == '+') && is_digit(p[2])))) {
+		p += 2;
+		while (is_digit(*p)) p++;
+	}
+	len = p - s;
+	if (len > (int)sizeof(tmp) - 1) len = sizeof(tmp) - 1;
+	memcpy(tmp, s, len);
+	tmp[len] = 0;
+	*v = strtod(tmp, NULL);
+	return p - s;
+}
+
+// match a template, returns the number of fields, or -1
+static int match(const char *tmpl, const char *line, const char **keys,
+	int *keylens, double *values)
+{
+	const char *k;
+	int n = 0, len, klen;
+
+	while (*tmpl) {
+		if (*tmpl == '{') {
+			k = ++tmpl;
+			while (*tmpl && *tmpl != '}') tmpl++;
+			klen = tmpl - k;
+			if (*tmpl) tmpl++;
+			if (klen == 0) {
+				// skip text up to the next literal character
+				if (*tmpl == 0) return n;
+				while (*line && *line != *tmpl) line++;
+				continue;
+			}
+			if (n < AGG_FIELDS) {
+				len = number(line, values + n);
+				if (!len) return -1;
+				keys[n] = k;
+				keylens[n] = klen;
+				n++;
+			} else {
+				len = number(line, values + AGG_FIELDS);
+				if (!len) return -1;
+			}
+			line += len;
+		} else {
+			if (*tmpl++ != *line++) return -1;
+		}
+	}
+	return *line ? -1 : n;
+}
+
+static void parse_line(struct aggregate_struct *a, const char *line)
+{
+	const char *keys[AGG_FIELDS], *p, *k;
+	int keylens[AGG_FIELDS], nfields = 0;
+	double values[AGG_FIELDS + 1], v;
+	char name[AGG_NAME];
+	struct msgtype *t = NULL;
+	int i, n, len;
+
+	a->lines++;
+	for (i=0; i < a->ntemplates; i++) {
+		nfields = match(a->template[i].text, line, keys, keylens, values);
+		if (nfields >= 0) {
+			t = a->template[i].type;
+			break;
+		}
+	}
+	if (i >= a->ntemplates) {
+		// key=value fields, and a name with every number masked
+		nfields = 0;
+		n = 0;
+		p = line;
+		while (*p) {
+			if (*p == '=' && p > line && is_keychar(p[-1])
+			  && (len = number(p + 1, &v)) > 0) {
+				for (k = p; k > line && is_keychar(k[-1]); k--) ;
+				if (nfields < AGG_FIELDS) {
+					keys[nfields] = k;
+					keylens[nfields] = p - k;
+					values[nfields++] = v;
+				}
+				if (n < AGG_NAME - 2) {
+					name[n++] = '=';
+					name[n++] = '#';
+				}
+				p += len + 1;
+				// units or anything else up to the next space
+				while (*p && *p != ' ' && *p != ',' && *p != ';') p++;
+				continue;
+			}
+			if (is_digit(*p)) {
+				while (is_digit(*p) || *p == '.') p++;
+				if (n < AGG_NAME - 1) name[n++] = '#';
+				continue;
+			}
+			if (n < AGG_NAME - 1) name[n++] = *p;
+			p++;
+		}
+		name[n] = 0;
+		t = find_type(a, name);
+	}
+	if (!t) {
+		a->other_total++;
+		a->other_interval++;
+		return;
+	}
+	t->total++;
+	t->interval++;
+	for (i=0; i < nfields; i++) {
+		add_field(t, keys[i], keylens[i], values[i]);
+	}
+}
+
+static int load_templates(struct aggregate_struct *a, const char *filename)
+{
+	FILE *fp;
+	char line[AGG_LINE];
+	struct template *t;
+	int len, r = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		printf("aggregate: unable to read %s\n", filename);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		len = strlen(line);
+		while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
+			line[--len] = 0;
+		}
+		if (len == 0 || line[0] == '#') continue;
+		if (a->ntemplates >= AGG_TEMPLATES) {
+			printf("aggregate: only %d templates allowed\n", AGG_TEMPLATES);
+			r = -1;
+			break;
+		}
+		t = a->template + a->ntemplates;
+		strcpy(t->text, line);
+		t->type = find_type(a, line);
+		a->ntemplates++;
+	}
+	if (ferror(fp)) {
+		printf("aggregate: unable to read %s\n", filename);
+		r = -1;
+	}
+	fclose(fp);
+	return r;
+}
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                              Summaries                              **/
+/**                                                                     **/
+/*************************************************************************/
+
+static void emit(struct aggregate_struct *a, const char *format, ...)
+{
+	char buf[256];
+	va_list args;
+	int len;
+
+	va_start(args, format);
+	len = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	if (len < 0) return;
+	if (len >= (int)sizeof(buf)) len = sizeof(buf) - 1;
+	a->out(buf, len);
+}
+
+void aggregate_print(aggregate_t *h)
+{
+	struct aggregate_struct *a;
+	struct msgtype *t;
+	struct sketch *s;
+	double secs;
+	uint64_t t_ns;
+	int i, j;
+
+	a = (struct aggregate_struct *)h;
+	if (!a) return;
+	t_ns = timestamp_ns();
+	secs = (t_ns - a->last) / 1e9;
+	if (secs <= 0) secs = 1e-9;
+	emit(a, "\n[aggregate %.0fs: %llu lines", (t_ns - a->begin) / 1e9,
+		(unsigned long long)a->lines);
+	if (a->truncated) emit(a, ", %llu truncated", (unsigned long long)a->truncated);
+	emit(a, "; rates and fields for the last %.1fs]\n", secs);
+	for (i=0; i < AGG_TYPES; i++) {
+		t = a->type + i;
+		if (!t->hash || !t->total) continue;
+		emit(a, "%9.1f/s %10llu  %s\n", t->interval / secs,
+			(unsigned long long)t->total, t->name);
+		for (j=0; j < t->nfields; j++) {
+			s = &t->field[j].values;
+			if (s->count == 0) continue;
+			emit(a, "%22s%s: n=%lu min=%g p50=%g p99=%g max=%g avg=%g\n", "",
+				t->field[j].key, (unsigned long)s->count, s->min,
+				sketch_percentile(s, 50.0), sketch_percentile(s, 99.0),
+				s->max, s->sum / s->count);
+			memset(s, 0, sizeof(struct sketch));
+		}
+		t->interval = 0;
+	}
+	if (a->other_total) {
+		emit(a, "%9.1f/s %10llu  (other)\n", a->other_interval / secs,
+			(unsigned long long)a->other_total);
+		a->other_interval = 0;
+	}
+	a->last = t_ns;
+}
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                            Public API                               **/
+/**                                                                     **/
+/*************************************************************************/
+
+aggregate_t * aggregate_open(const char *template_file, int seconds, aggregate_output_t out)
+{
+	struct aggregate_struct *a;
+
+	if (seconds < 1) seconds = 1;
+	a = (struct aggregate_struct *)calloc(1, sizeof(struct aggregate_struct));
+	if (!a) return NULL;
+	a->out = out;
+	a->interval_ns = (uint64_t)seconds * 1000000000;
+	a->begin = a->last = timestamp_ns();
+	a->next = a->begin + a->interval_ns;
+	if (template_file && load_templates(a, template_file) < 0) {
+		free(a);
+		return NULL;
+	}
+	return a;
+}
+
+static void end_line(struct aggregate_struct *a)
+{
+	if (a->linelen > 0) {
+		a->line[a->linelen] = 0;
+		parse_line(a, a->line);
+	}
+	a->linelen = 0;
+	a->overflow = 0;
+}
+
+// text from the device, in pieces of any size
+void aggregate_feed(aggregate_t *h, const void *buf, int len)
+{
+	struct aggregate_struct *a;
+	const char *p;
+	int i;
+
+	a = (struct aggregate_struct *)h;
+	if (!a) return;
+	p = (const char *)buf;
+	for (i=0; i < len; i++) {
+		if (p[i] == '\n' || p[i] == '\r') {
+			end_line(a);
+		} else if (a->linelen < AGG_LINE - 1) {
+			a->line[a->linelen++] = p[i];
+		} else if (!a->overflow) {
+			a->overflow = 1;
+			a->truncated++;
+		}
+	}
+}
+
+// the device is gone, so its last line is complete, and must not be
+// joined to the first line of the next device
+void aggregate_flush(aggregate_t *h)
+{
+	if (!h) return;
+	end_line((struct aggregate_struct *)h);
+}
+
+void aggregate_poll(aggregate_t *h)
+{
+	struct aggregate_struct *a;
+	uint64_t t;
+
+	a = (struct aggregate_struct *)h;
+	if (!a) return;
+	t = timestamp_ns();
+	if (t < a->next) return;
+	aggregate_print(a);
+	a->next = t + a->interval_ns;
+}
+
+void aggregate_close(aggregate_t *h)
+{
+	free(h);
+}
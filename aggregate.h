@@ -0,0 +1,14 @@
+#ifndef aggregate_included_h__
+#define aggregate_included_h__
+
+// Streaming Aggregation of Debug Text
+typedef void aggregate_t;
+typedef void (*aggregate_output_t)(const void *buf, int len);
+aggregate_t * aggregate_open(const char *template_file, int seconds, aggregate_output_t out);
+void aggregate_feed(aggregate_t *a, const void *buf, int len);
+void aggregate_flush(aggregate_t *a);
+void aggregate_poll(aggregate_t *a);
+void aggregate_print(aggregate_t *a);
+void aggregate_close(aggregate_t *a);
+
+#endif
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Throughput of hid_listen at 64, 512 and 1024 byte reports, using a
+# virtual device from uhid_teensy.  Linux only, usually needs root.
+# The time is measured by hid_listen itself, from the first report it
+# received to the last, so it is the reader's throughput.
+
+COUNT=${COUNT:-20000}
+OUT=`mktemp`
+ERR=`mktemp`
+
+for size in 64 512 1024; do
+	./hid_listen -L 0 > $OUT 2> $ERR &
+	pid=$!
+	./uhid_teensy -s $size -n $COUNT > /dev/null
+	sleep 1
+	kill $pid
+	wait $pid 2>/dev/null
+	lines=`grep -c '^[0-9]\{15\}$' $OUT`
+	secs=`awk '/^received:/ { secs = $7 } END { print secs + 0 }' $ERR`
+	sent=$(( COUNT * (size / 16) ))
+	awk -v size=$size -v secs=$secs -v lines=$lines -v sent=$sent 'BEGIN {
+		printf "%5d byte reports: %8.2f MB/s, %6.2f%% lost\n", size,
+			secs > 0 ? lines * 16 / secs / 1e6 : 0, (sent - lines) * 100 / sent }'
+done
+rm -f $OUT $ERR
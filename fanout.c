@@ -0,0 +1,328 @@
+/* Local Fan-Out Server
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// A HID device can only be read by one program at a time, because
+// each report is consumed by whoever reads it first.  The fan-out
+// server lets hid_listen own the device and republish everything it
+// prints on a Unix domain socket.  All subscribers share one ring
+// buffer, and each one has its own cursor (a 64 bit stream position)
+// into that ring.  Every socket is non-blocking, so a slow subscriber
+// can never stall the device reader.  When a subscriber falls more
+// than a full ring behind, it is either skipped ahead with a marker
+// showing how many bytes it lost, or disconnected.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "fanout.h"
+
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+
+// Unix domain sockets are not available in this build
+fanout_t * fanout_open(const char *path, int ring_size, int slow_policy)
+{
+	printf("fanout: not supported on Windows\n");
+	return NULL;
+}
+void fanout_publish(fanout_t *f, const void *buf, int len) { }
+void fanout_poll(fanout_t *f) { }
+int fanout_count(fanout_t *f) { return 0; }
+void fanout_close(fanout_t *f) { }
+int fanout_subscribe(const char *path)
+{
+	printf("fanout: not supported on Windows\n");
+	return -1;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define FANOUT_MAX_SUBSCRIBERS	32
+
+// writes to a departed subscriber must return EPIPE, not raise SIGPIPE,
+// which would also change what happens when stdout is closed.  Mac has
+// no MSG_NOSIGNAL, but a per-socket option instead.
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+struct fanout_sub {
+	int fd;
+	uint64_t pos;		// stream position of the next byte to send
+	uint64_t dropped;	// bytes skipped, not yet reported by a marker
+	char note[64];		// pending drop marker
+	int note_len;
+	int note_off;
+};
+
+struct fanout_struct {
+	int fd;
+	int policy;
+	char *ring;
+	uint32_t size;		// always a power of 2
+	uint64_t head;		// total bytes ever published
+	int count;
+	struct fanout_sub sub[FANOUT_MAX_SUBSCRIBERS];
+	struct sockaddr_un addr;
+};
+
+
+static int set_nonblocking(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void drop_sub(struct fanout_struct *f, int n)
+{
+	close(f->sub[n].fd);
+	f->count--;
+	if (n < f->count) f->sub[n] = f->sub[f->count];
+}
+
+// send as much as the socket will take, -1 if the subscriber is gone
+static int flush_sub(struct fanout_struct *f, struct fanout_sub *s)
+{
+	uint32_t off, len;
+	int r;
+
+	if (f->head - s->pos > f->size) {
+		if (f->policy == FANOUT_SLOW_DISCONNECT) return -1;
+		s->dropped += f->head - f->size - s->pos;
+		s->pos = f->head - f->size;
+	}
+	while (1) {
+		if (s->note_off == s->note_len && s->dropped) {
+			s->note_len = snprintf(s->note, sizeof(s->note),
+				"\n[hid_listen: %llu bytes dropped]\n",
+				(unsigned long long)s->dropped);
+			s->note_off = 0;
+			s->dropped = 0;
+		}
+		if (s->note_off < s->note_len) {
+			r = send(s->fd, s->note + s->note_off,
+				s->note_len - s->note_off, MSG_NOSIGNAL);
+			if (r < 0) break;
+			s->note_off += r;
+			continue;
+		}
+		if (s->pos == f->head) return 0;
+		off = (uint32_t)s->pos & (f->size - 1);
+		len = f->size - off;
+		if (len > f->head - s->pos) len = (uint32_t)(f->head - s->pos);
+		r = send(s->fd, f->ring + off, len, MSG_NOSIGNAL);
+		if (r < 0) break;
+		s->pos += r;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+	return -1;
+}
+
+
+// returns 1 if nobody is listening on the socket, 0 if someone is,
+// -1 if unable to tell
+static int stale_socket(const struct sockaddr_un *addr)
+{
+	int fd, r;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	r = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	if (r < 0 && errno == ECONNREFUSED) {
+		r = 1;
+	} else {
+		r = (r == 0) ? 0 : -1;
+	}
+	close(fd);
+	return r;
+}
+
+fanout_t * fanout_open(const char *path, int ring_size, int slow_policy)
+{
+	struct fanout_struct *f;
+	struct stat st;
+	uint32_t size;
+
+	if (strlen(path) >= sizeof(f->addr.sun_path)) {
+		printf("fanout: socket path too long: %s\n", path);
+		return NULL;
+	}
+	for (size=4096; size < (uint32_t)ring_size && size < 0x40000000; size <<= 1) ;
+	f = (struct fanout_struct *)malloc(sizeof(struct fanout_struct));
+	if (!f) return NULL;
+	f->ring = (char *)malloc(size);
+	if (!f->ring) {
+		free(f);
+		return NULL;
+	}
+	f->size = size;
+	f->head = 0;
+	f->count = 0;
+	f->policy = slow_policy;
+	memset(&f->addr, 0, sizeof(f->addr));
+	f->addr.sun_family = AF_UNIX;
+	strcpy(f->addr.sun_path, path);
+	// a stale socket from an earlier run would make bind() fail, but
+	// one which still accepts connections belongs to a running server
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if (stale_socket(&f->addr) <= 0) {
+			printf("fanout: %s is in use by another server\n", path);
+			free(f->ring);
+			free(f);
+			return NULL;
+		}
+		unlink(path);
+	}
+	f->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (f->fd < 0 || set_nonblocking(f->fd) < 0
+	  || bind(f->fd, (struct sockaddr *)&f->addr, sizeof(f->addr)) < 0
+	  || listen(f->fd, 8) < 0) {
+		printf("fanout: unable to listen on %s, errno=%d\n", path, errno);
+		if (f->fd >= 0) close(f->fd);
+		free(f->ring);
+		free(f);
+		return NULL;
+	}
+	return f;
+}
+
+void fanout_publish(fanout_t *h, const void *buf, int len)
+{
+	struct fanout_struct *f;
+	const char *p;
+	uint32_t off, n;
+	int i;
+
+	f = (struct fanout_struct *)h;
+	if (!f || len <= 0) return;
+	p = (const char *)buf;
+	if ((uint32_t)len > f->size) {
+		// only the newest ring-full can ever be delivered
+		f->head += len - f->size;
+		p += len - f->size;
+		len = f->size;
+	}
+	while (len > 0) {
+		off = (uint32_t)f->head & (f->size - 1);
+		n = f->size - off;
+		if (n > (uint32_t)len) n = len;
+		memcpy(f->ring + off, p, n);
+		f->head += n;
+		p += n;
+		len -= n;
+	}
+	for (i=0; i < f->count; ) {
+		if (flush_sub(f, &f->sub[i]) < 0) {
+			drop_sub(f, i);
+		} else {
+			i++;
+		}
+	}
+}
+
+void fanout_poll(fanout_t *h)
+{
+	struct fanout_struct *f;
+	struct fanout_sub *s;
+	char tmp[64];
+	int fd, i, r;
+#ifdef SO_NOSIGPIPE
+	int one = 1;
+#endif
+
+	f = (struct fanout_struct *)h;
+	if (!f) return;
+	while ((fd = accept(f->fd, NULL, NULL)) >= 0) {
+#ifdef SO_NOSIGPIPE
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+		if (f->count >= FANOUT_MAX_SUBSCRIBERS || set_nonblocking(fd) < 0) {
+			close(fd);
+			continue;
+		}
+		// new subscribers see the live stream, not old history
+		s = &f->sub[f->count++];
+		s->fd = fd;
+		s->pos = f->head;
+		s->dropped = 0;
+		s->note_len = s->note_off = 0;
+	}
+	for (i=0; i < f->count; ) {
+		s = &f->sub[i];
+		// subscribers never send anything, so readable means closed
+		r = read(s->fd, tmp, sizeof(tmp));
+		if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+		  || flush_sub(f, s) < 0) {
+			drop_sub(f, i);
+		} else {
+			i++;
+		}
+	}
+}
+
+int fanout_count(fanout_t *h)
+{
+	if (!h) return 0;
+	return ((struct fanout_struct *)h)->count;
+}
+
+void fanout_close(fanout_t *h)
+{
+	struct fanout_struct *f;
+
+	f = (struct fanout_struct *)h;
+	if (!f) return;
+	while (f->count > 0) drop_sub(f, f->count - 1);
+	close(f->fd);
+	unlink(f->addr.sun_path);
+	free(f->ring);
+	free(f);
+}
+
+int fanout_subscribe(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+#endif
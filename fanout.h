@@ -0,0 +1,17 @@
+#ifndef fanout_included_h__
+#define fanout_included_h__
+
+// Local Fan-Out Server, publishes the listen stream on a Unix socket
+typedef void fanout_t;
+#define FANOUT_SLOW_DROP	0	// skip ahead and insert a drop marker
+#define FANOUT_SLOW_DISCONNECT	1	// close subscribers that fall behind
+fanout_t * fanout_open(const char *path, int ring_size, int slow_policy);
+void fanout_publish(fanout_t *f, const void *buf, int len);
+void fanout_poll(fanout_t *f);
+int fanout_count(fanout_t *f);
+void fanout_close(fanout_t *f);
+
+// Local Fan-Out Server, subscriber side
+int fanout_subscribe(const char *path);
+
+#endif
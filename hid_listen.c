@@ -22,34 +22,155 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include "rawhid.h"
+#include "fanout.h"
+#include "shmring.h"
+#include "tokenlog.h"
+#include "rtmode.h"
+#include "probe.h"
+#include "aggregate.h"
 
 
 static void delay_ms(unsigned int msec);
+static void output(const void *buf, int len);
+static void stream(const void *buf, int len);
+static int subscribe(const char *path);
+static void usage(void);
 
+static fanout_t *fanout = NULL;
+static aggregate_t *aggregate = NULL;
 
-int main(void)
+
+int main(int argc, char **argv)
 {
-	char buf[64], *in, *out;
+	char *buf, *text, *in, *out;
 	rawhid_t *hid;
-	int num, count;
+	int num, count, arg, size;
+	const char *serve_path = NULL, *shm_name = NULL, *token_file = NULL;
+	const char *template_file = NULL;
+	int ring_size = 65536, slow_policy = FANOUT_SLOW_DROP;
+	int shm_slots = 4096;
+	shmring_t *shm = NULL;
+	tokenlog_t *tokens = NULL;
+	uint32_t device_id = 0;
+	int stats = 0, probe_rate = 0, summary_interval = 0;
+	probe_t *probe = NULL;
 
-	printf("Waiting for device:");
-	fflush(stdout);
+	for (arg=1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "-s") == 0 && arg+1 < argc) {
+			serve_path = argv[++arg];
+		} else if (strcmp(argv[arg], "-c") == 0 && arg+1 < argc) {
+			return subscribe(argv[++arg]);
+		} else if (strcmp(argv[arg], "-r") == 0 && arg+1 < argc) {
+			ring_size = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-m") == 0 && arg+1 < argc) {
+			shm_name = argv[++arg];
+		} else if (strcmp(argv[arg], "-M") == 0 && arg+1 < argc) {
+			shm_slots = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-t") == 0 && arg+1 < argc) {
+			token_file = argv[++arg];
+		} else if (strcmp(argv[arg], "-C") == 0 && arg+1 < argc) {
+			if (rtmode_pin_cpu(atoi(argv[++arg])) < 0) return 1;
+		} else if (strcmp(argv[arg], "-F") == 0 && arg+1 < argc) {
+			if (rtmode_fifo(atoi(argv[++arg])) < 0) return 1;
+		} else if (strcmp(argv[arg], "-l") == 0) {
+			if (rtmode_lock_memory() < 0) return 1;
+		} else if (strcmp(argv[arg], "-b") == 0) {
+			rtmode_busy_poll(1);
+		} else if (strcmp(argv[arg], "-L") == 0 && arg+1 < argc) {
+			stats = 1;
+			rtmode_stats_interval(atoi(argv[++arg]));
+		} else if (strcmp(argv[arg], "-P") == 0 && arg+1 < argc) {
+			probe_rate = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-a") == 0 && arg+1 < argc) {
+			summary_interval = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-T") == 0 && arg+1 < argc) {
+			template_file = argv[++arg];
+		} else if (strcmp(argv[arg], "-S") == 0 && arg+1 < argc) {
+			arg++;
+			if (strcmp(argv[arg], "drop") == 0) {
+				slow_policy = FANOUT_SLOW_DROP;
+			} else if (strcmp(argv[arg], "disconnect") == 0) {
+				slow_policy = FANOUT_SLOW_DISCONNECT;
+			} else {
+				usage();
+				return 1;
+			}
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (token_file) {
+		tokens = tokenlog_open(token_file);
+		if (!tokens) return 1;
+		printf("Loaded %d format strings from %s\n",
+			tokenlog_count(tokens), token_file);
+	}
+	if (serve_path) {
+		fanout = fanout_open(serve_path, ring_size, slow_policy);
+		if (!fanout) return 1;
+	}
+	if (summary_interval > 0 || template_file) {
+		if (summary_interval <= 0) summary_interval = 60;
+		aggregate = aggregate_open(template_file, summary_interval, output);
+		if (!aggregate) return 1;
+	}
+	if (probe_rate > 0) {
+		probe = probe_open(probe_rate);
+		if (!probe) return 1;
+	}
+
+	output("Waiting for device:", -1);
 	while (1) {
 		hid = rawhid_open_only1(0, 0, 0xFF31, 0x0074);
 		if (hid == NULL) {
-			printf(".");
-			fflush(stdout);
+			output(".", -1);
 			delay_ms(1000);
+			fanout_poll(fanout);
+			aggregate_poll(aggregate);
 			continue;
 		}
-		printf("\nListening:\n");
+		// a buffer for the largest report this device can send,
+		// and room for binary log records to expand into text
+		size = rawhid_report_size(hid);
+		if (size < 64) size = 64;
+		buf = (char *)malloc(size);
+		text = (char *)malloc(size * 64);
+		if (!buf || !text) {
+			free(buf);
+			free(text);
+			rawhid_close(hid);
+			delay_ms(1000);
+			continue;
+		}
+		if (shm_name && !shm) {
+			// slots sized for the first device's reports
+			shm = shmring_open(shm_name, shm_slots, size);
+			if (!shm) return 1;
+		}
+		output("\nListening:\n", -1);
+		device_id++;
+		if (probe && probe_start(probe, hid, size) < 0) {
+			fprintf(stderr, "probe: unable to start\n");
+		}
 		while (1) {
-			num = rawhid_read(hid, buf, sizeof(buf), 200);
+			fanout_poll(fanout);
+			aggregate_poll(aggregate);
+			num = rtmode_read(hid, buf, size, 200);
 			if (num < 0) break;
 			if (num == 0) continue;
+			// echoed probe reports never reach the debug stream
+			if (probe_receive(probe, buf, num)) continue;
+			shmring_publish(shm, device_id, buf, num);
+			count = tokenlog_decode(tokens, buf, num, text, size * 64);
+			if (count >= 0) {
+				// binary log records, expanded on this side
+				if (count) stream(text, count);
+				continue;
+			}
 			in = out = buf;
 			for (count=0; count<num; count++) {
 				if (*in) {
@@ -60,17 +181,66 @@ int main(void)
 			count = out - buf;
 			//printf("read %d bytes, %d actual\n", num, count);
 			if (count) {
-				num = fwrite(buf, 1, count, stdout);
-				fflush(stdout);
+				stream(buf, count);
 			}
 		}
+		probe_stop(probe);
 		rawhid_close(hid);
-		printf("\nDevice disconnected.\nWaiting for new device:");
+		if (stats) rtmode_print_stats();
+		probe_print(probe);
+		aggregate_flush(aggregate);
+		aggregate_print(aggregate);
+		free(buf);
+		free(text);
+		output("\nDevice disconnected.\nWaiting for new device:", -1);
 	}
 	return 0;
 }
 
 
+// everything shown on stdout is also published to fan-out subscribers
+static void output(const void *buf, int len)
+{
+	if (len < 0) len = strlen((const char *)buf);
+	fwrite(buf, 1, len, stdout);
+	fflush(stdout);
+	fanout_publish(fanout, buf, len);
+}
+
+// text from the device, unless it is only being summarized
+static void stream(const void *buf, int len)
+{
+	if (aggregate) {
+		aggregate_feed(aggregate, buf, len);
+	} else {
+		output(buf, len);
+	}
+}
+
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: hid_listen [options]\n"
+		"  -s path          serve the stream to subscribers on a Unix socket\n"
+		"  -r bytes         fan-out ring buffer size (default 65536)\n"
+		"  -S drop|disconnect  what to do with slow subscribers\n"
+		"  -m name          publish reports to a shared memory ring\n"
+		"  -M slots         shared memory ring size (default 4096)\n"
+		"  -t file          decode binary log records using format strings\n"
+		"                   from a firmware ELF file or an id/format list\n"
+		"  -C cpu           pin the reader to one CPU\n"
+		"  -F priority      run the reader with SCHED_FIFO priority\n"
+		"  -l               lock and prefault memory\n"
+		"  -b               busy poll the device, with adaptive backoff\n"
+		"  -L seconds       print gaps between reports and throughput to\n"
+		"                   stderr (0 = only when the device disconnects)\n"
+		"  -P rate          measure round trip latency, sending rate echo\n"
+		"                   requests per second (up to 1000)\n"
+		"  -a seconds       print only summaries of the text, every few\n"
+		"                   seconds: message rates and numeric fields\n"
+		"  -T file          message templates for -a, \"text {field} text\"\n"
+		"  -c path          subscribe to another hid_listen's socket\n");
+}
 
 
 
@@ -81,10 +251,33 @@ static void delay_ms(unsigned int msec)
 {
 	Sleep(msec);
 }
+static int subscribe(const char *path)
+{
+	fanout_subscribe(path);
+	return 1;
+}
 #else
 #include <unistd.h>
 static void delay_ms(unsigned int msec)
 {
 	usleep(msec * 1000);
 }
+static int subscribe(const char *path)
+{
+	char buf[4096];
+	int fd, num;
+
+	fd = fanout_subscribe(path);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to connect to %s\n", path);
+		return 1;
+	}
+	while ((num = read(fd, buf, sizeof(buf))) > 0) {
+		fwrite(buf, 1, num, stdout);
+		fflush(stdout);
+	}
+	close(fd);
+	printf("\nServer disconnected.\n");
+	return 0;
+}
 #endif
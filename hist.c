@@ -0,0 +1,79 @@
+/* Log-Linear Histogram
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include <string.h>
+#include "hist.h"
+
+#define HIST_LIMIT	((uint64_t)1 << 48)
+
+
+void hist_reset(struct hist *h)
+{
+	memset(h, 0, sizeof(struct hist));
+}
+
+static int index_of(uint64_t v)
+{
+	int msb, shift;
+
+	if (v < HIST_SUB * 2) return (int)v;
+	if (v >= HIST_LIMIT) v = HIST_LIMIT - 1;
+	for (msb = 6; (v >> (msb + 1)) != 0; msb++) ;
+	shift = msb - 5;
+	return HIST_SUB * 2 + (shift - 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+// the middle of the range of values counted by a bucket
+static uint64_t value_of(int idx)
+{
+	int shift;
+	uint64_t top;
+
+	if (idx < HIST_SUB * 2) return idx;
+	idx -= HIST_SUB * 2;
+	shift = idx / HIST_SUB + 1;
+	top = idx % HIST_SUB + HIST_SUB;
+	return (top << shift) + ((uint64_t)1 << (shift - 1));
+}
+
+void hist_record(struct hist *h, uint64_t value)
+{
+	h->bucket[index_of(value)]++;
+	if (h->count == 0 || value < h->min) h->min = value;
+	if (value > h->max) h->max = value;
+	h->sum += value;
+	h->count++;
+}
+
+uint64_t hist_percentile(const struct hist *h, double percent)
+{
+	uint64_t want, seen = 0, v;
+	int i;
+
+	if (h->count == 0) return 0;
+	want = (uint64_t)(percent / 100.0 * h->count + 0.5);
+	if (want < 1) want = 1;
+	for (i=0; i < HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= want) break;
+	}
+	if (i >= HIST_BUCKETS) return h->max;
+	v = value_of(i);
+	if (v < h->min) v = h->min;
+	if (v > h->max) v = h->max;
+	return v;
+}
@@ -0,0 +1,24 @@
+#ifndef hist_included_h__
+#define hist_included_h__
+
+#include <stdint.h>
+
+// Log-Linear Histogram, in the style of HdrHistogram.  Values below
+// 64 are counted exactly, larger values in 32 buckets per power of 2
+// (about 3% resolution), up to 2^48.  Memory use is fixed.
+#define HIST_SUB	32
+#define HIST_BUCKETS	(HIST_SUB * 2 + 42 * HIST_SUB)
+
+struct hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t bucket[HIST_BUCKETS];
+};
+
+void hist_reset(struct hist *h);
+void hist_record(struct hist *h, uint64_t value);
+uint64_t hist_percentile(const struct hist *h, double percent);
+
+#endif
@@ -0,0 +1,365 @@
+/* Round-Trip Latency Probe
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// The probe measures how long a report takes to go to the device and
+// come back.  At a fixed rate, it sends an output report containing
+//
+//   PROBE_MARKER, 'P', sequence number (4 bytes), host time in ns (8 bytes)
+//
+// (little endian, zero padded to the report size) and the firmware
+// is expected to send the same bytes back as an input report.  The
+// requests are sent by a thread of their own, so a slow or stuck write
+// never holds up the read loop, and the replies are taken out of the
+// stream, so the normal debug text is not disturbed.  Round trip times
+// go into a fixed size histogram.  A request with no reply after 1
+// second, or by the time its slot in the window of outstanding
+// requests is needed again, is lost, and a reply arriving after that
+// only counts as stray.  Requests the device would not accept are
+// counted as failed, not sent.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "probe.h"
+#include "hist.h"
+#include "timestamp.h"
+
+#define PROBE_WINDOW	1024
+#define PROBE_TIMEOUT	1000000000ull	// 1 second
+#define PROBE_REPORT	10000000000ull	// print a summary every 10 seconds
+#define PROBE_LEN	14
+#define PROBE_WRITE_MS	100	// not honoured by Linux and Mac writes
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+#include <windows.h>
+typedef CRITICAL_SECTION probe_lock_t;
+#define lock_init(l)	InitializeCriticalSection(l)
+#define lock_free(l)	DeleteCriticalSection(l)
+#define lock(l)		EnterCriticalSection(l)
+#define unlock(l)	LeaveCriticalSection(l)
+#else
+#include <pthread.h>
+#include <time.h>
+typedef pthread_mutex_t probe_lock_t;
+#define lock_init(l)	pthread_mutex_init(l, NULL)
+#define lock_free(l)	pthread_mutex_destroy(l)
+#define lock(l)		pthread_mutex_lock(l)
+#define unlock(l)	pthread_mutex_unlock(l)
+#endif
+
+struct probe_struct {
+	probe_lock_t lock;	// everything below is shared with the sender
+	uint64_t interval;	// ns between requests
+	uint64_t next_report;
+	uint32_t seq;		// of the next request
+	uint32_t oldest;	// of the oldest request which may be unanswered
+	uint32_t slot_seq[PROBE_WINDOW];
+	uint64_t slot_time[PROBE_WINDOW];	// 0 when answered or lost
+	uint64_t sent;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t failed;	// writes the device did not accept
+	uint64_t stray;		// late, duplicate or unknown replies
+	struct hist rtt;
+	// the sender thread
+	rawhid_t *hid;
+	int size;
+	uint8_t *buf;
+	int stop;
+	int running;
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+static void sleep_ns(uint64_t ns)
+{
+	Sleep((DWORD)((ns + 999999) / 1000000));
+}
+#else
+static void sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	nanosleep(&ts, NULL);
+}
+#endif
+
+static void put32(uint8_t *p, uint32_t n)
+{
+	p[0] = n;
+	p[1] = n >> 8;
+	p[2] = n >> 16;
+	p[3] = n >> 24;
+}
+
+// declare requests lost which are too old, or whose slot is needed
+// for the next request.  Called with the lock held.
+static void expire(struct probe_struct *p, uint64_t t)
+{
+	int slot;
+
+	while (p->oldest != p->seq) {
+		slot = p->oldest % PROBE_WINDOW;
+		if (p->slot_time[slot]) {
+			if (t - p->slot_time[slot] < PROBE_TIMEOUT
+			  && p->seq - p->oldest < PROBE_WINDOW) break;
+			p->slot_time[slot] = 0;
+			p->lost++;
+		}
+		p->oldest++;
+	}
+}
+
+// a copy of the counters, so they can be printed without the lock,
+// and a blocked stderr never holds up the read loop
+struct summary {
+	uint64_t sent;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t failed;
+	uint64_t stray;
+	uint64_t rtt_count;
+	uint64_t rtt_min;
+	uint64_t rtt_p50;
+	uint64_t rtt_p99;
+	uint64_t rtt_max;
+};
+
+// called with the lock held, returns 0 if there is nothing to print
+static int summarize(struct probe_struct *p, struct summary *s)
+{
+	if (!p->sent && !p->failed) return 0;
+	expire(p, timestamp_ns());
+	s->sent = p->sent;
+	s->received = p->received;
+	s->lost = p->lost;
+	s->failed = p->failed;
+	s->stray = p->stray;
+	s->rtt_count = p->rtt.count;
+	if (s->rtt_count) {
+		s->rtt_min = p->rtt.min;
+		s->rtt_p50 = hist_percentile(&p->rtt, 50.0);
+		s->rtt_p99 = hist_percentile(&p->rtt, 99.0);
+		s->rtt_max = p->rtt.max;
+	}
+	return 1;
+}
+
+static void print_summary(const struct summary *s)
+{
+	fprintf(stderr, "probe: sent=%llu received=%llu lost=%llu (%.2f%%)",
+		(unsigned long long)s->sent, (unsigned long long)s->received,
+		(unsigned long long)s->lost, s->sent ? s->lost * 100.0 / s->sent : 0.0);
+	if (s->failed) fprintf(stderr, " failed=%llu", (unsigned long long)s->failed);
+	if (s->stray) fprintf(stderr, " stray=%llu", (unsigned long long)s->stray);
+	if (s->rtt_count) {
+		fprintf(stderr, " rtt min=%.1fus p50=%.1fus p99=%.1fus max=%.1fus",
+			s->rtt_min / 1000.0, s->rtt_p50 / 1000.0,
+			s->rtt_p99 / 1000.0, s->rtt_max / 1000.0);
+	}
+	fprintf(stderr, "\n");
+}
+
+static void sender_loop(struct probe_struct *p)
+{
+	struct summary sum;
+	uint64_t t, next_send;
+	int slot, r, print;
+
+	next_send = timestamp_ns();
+	while (!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) {
+		t = timestamp_ns();
+		if (t < next_send) {
+			// wake up often enough to notice probe_stop
+			sleep_ns(next_send - t < 100000000 ? next_send - t : 100000000);
+			continue;
+		}
+		lock(&p->lock);
+		expire(p, t);
+		slot = p->seq % PROBE_WINDOW;
+		p->slot_seq[slot] = p->seq;
+		p->slot_time[slot] = t;
+		p->seq++;
+		p->sent++;
+		unlock(&p->lock);
+		// the reply may arrive before the write returns, so the
+		// request is recorded first, and taken back if it failed
+		p->buf[0] = PROBE_MARKER;
+		p->buf[1] = 'P';
+		put32(p->buf + 2, p->seq - 1);
+		put32(p->buf + 6, (uint32_t)t);
+		put32(p->buf + 10, (uint32_t)(t >> 32));
+		r = rawhid_write(p->hid, p->buf, p->size, PROBE_WRITE_MS);
+		lock(&p->lock);
+		if (r < 0 && p->slot_seq[slot] == p->seq - 1 && p->slot_time[slot] == t) {
+			p->slot_time[slot] = 0;
+			p->sent--;
+			p->failed++;
+		}
+		t = timestamp_ns();
+		print = 0;
+		if (t >= p->next_report) {
+			print = summarize(p, &sum);
+			p->next_report = t + PROBE_REPORT;
+		}
+		unlock(&p->lock);
+		if (print) print_summary(&sum);
+		next_send += p->interval;
+		// after a long stall, do not send a burst to catch up
+		if (next_send < t) next_send = t + p->interval;
+	}
+}
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+static DWORD WINAPI sender_thread(LPVOID arg)
+{
+	sender_loop((struct probe_struct *)arg);
+	return 0;
+}
+#else
+static void * sender_thread(void *arg)
+{
+	sender_loop((struct probe_struct *)arg);
+	return NULL;
+}
+#endif
+
+
+probe_t * probe_open(int rate)
+{
+	struct probe_struct *p;
+
+	if (rate < 1) rate = 1;
+	if (rate > 1000) rate = 1000;
+	p = (struct probe_struct *)malloc(sizeof(struct probe_struct));
+	if (!p) return NULL;
+	memset(p, 0, sizeof(struct probe_struct));
+	lock_init(&p->lock);
+	p->interval = 1000000000ull / rate;
+	p->next_report = timestamp_ns() + PROBE_REPORT;
+	hist_reset(&p->rtt);
+	return p;
+}
+
+// start sending requests to a device, of its report size
+int probe_start(probe_t *h, rawhid_t *hid, int size)
+{
+	struct probe_struct *p;
+
+	p = (struct probe_struct *)h;
+	if (!p || p->running) return -1;
+	if (size < PROBE_LEN) size = PROBE_LEN;
+	p->buf = (uint8_t *)calloc(1, size);
+	if (!p->buf) return -1;
+	p->hid = hid;
+	p->size = size;
+	p->stop = 0;
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+	p->thread = CreateThread(NULL, 0, sender_thread, p, 0, NULL);
+	if (p->thread == NULL) {
+#else
+	if (pthread_create(&p->thread, NULL, sender_thread, p) != 0) {
+#endif
+		free(p->buf);
+		p->buf = NULL;
+		return -1;
+	}
+	p->running = 1;
+	return 0;
+}
+
+// stop sending, which must be done before the device is closed
+void probe_stop(probe_t *h)
+{
+	struct probe_struct *p;
+
+	p = (struct probe_struct *)h;
+	if (!p || !p->running) return;
+	__atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+	WaitForSingleObject(p->thread, INFINITE);
+	CloseHandle(p->thread);
+#else
+	pthread_join(p->thread, NULL);
+#endif
+	p->running = 0;
+	free(p->buf);
+	p->buf = NULL;
+}
+
+// returns 1 if this report was a probe reply, which it consumes
+int probe_receive(probe_t *h, const void *buf, int len)
+{
+	struct probe_struct *p;
+	const uint8_t *r;
+	uint32_t seq;
+	int slot;
+	uint64_t t;
+
+	p = (struct probe_struct *)h;
+	r = (const uint8_t *)buf;
+	if (!p || len < PROBE_LEN || r[0] != PROBE_MARKER || r[1] != 'P') return 0;
+	t = timestamp_ns();
+	seq = r[2] | (r[3] << 8) | (r[4] << 16) | ((uint32_t)r[5] << 24);
+	slot = seq % PROBE_WINDOW;
+	lock(&p->lock);
+	expire(p, t);
+	if (p->slot_seq[slot] != seq || !p->slot_time[slot]) {
+		p->stray++;
+	} else {
+		hist_record(&p->rtt, t - p->slot_time[slot]);
+		p->slot_time[slot] = 0;
+		p->received++;
+	}
+	unlock(&p->lock);
+	return 1;
+}
+
+void probe_print(probe_t *h)
+{
+	struct probe_struct *p;
+	struct summary sum;
+	int print;
+
+	p = (struct probe_struct *)h;
+	if (!p) return;
+	lock(&p->lock);
+	print = summarize(p, &sum);
+	unlock(&p->lock);
+	if (print) print_summary(&sum);
+}
+
+void probe_close(probe_t *h)
+{
+	struct probe_struct *p;
+
+	p = (struct probe_struct *)h;
+	if (!p) return;
+	probe_stop(p);
+	lock_free(&p->lock);
+	free(p);
+}
@@ -0,0 +1,17 @@
+#ifndef probe_included_h__
+#define probe_included_h__
+
+#include "rawhid.h"
+
+// Round-Trip Latency Probe
+#define PROBE_MARKER	0x1F	// first byte of echo requests and replies
+
+typedef void probe_t;
+probe_t * probe_open(int rate);
+int probe_start(probe_t *p, rawhid_t *hid, int size);
+void probe_stop(probe_t *p);
+int probe_receive(probe_t *p, const void *buf, int len);
+void probe_print(probe_t *p);
+void probe_close(probe_t *p);
+
+#endif
@@ -17,20 +17,25 @@
  */
 
 
-// This code will someday be turned into "librawhid", an easy-to-use
-// and truly cross platform library for accessing HID reports.  But
-// there are many complexities not properly handled by this simple
-// code that would be expected from a high quality library.  In
-// particular, how report IDs are handled is not uniform on the 3
-// platforms.  The mac code uses a single buffer which assumes no
-// other functions can cause the "run loop" to process HID callbacks.
-// The linux version doesn't extract usage and usage page from the
-// report descriptor and just hardcodes a signature for the Teensy
-// USB debug example.  Lacking from all platforms are functions to
-// manage multiple devices and robust detection of device removal
-// and attachment.  There are probably lots of other issues... this
-// code has really only been used in 2 projects.  If you use it,
-// please report bugs to paul@pjrc.com
+// This code is built as "librawhid" (make lib), which will someday
+// be an easy-to-use and truly cross platform library for accessing
+// HID reports.  Each handle may be used by several threads (but only
+// closed once none of them uses it any more), and reports can be
+// delivered in batches to a callback, either from an application's
+// own event loop or a reader thread.  But there are many complexities
+// not properly handled by this simple code that would be expected
+// from a high quality library.  Report
+// IDs are now handled the same on the 3 platforms: the ID byte is
+// never part of the data, and rawhid_read_id / rawhid_write_id pass
+// it separately.  Buffers are sized for the device's largest report.
+// The mac code uses a single buffer which assumes no other functions
+// can cause the "run loop" to process HID callbacks.  The linux
+// version parses only enough of the report descriptor to find the
+// usage, usage page and report sizes.  Lacking from all platforms
+// are functions to manage multiple devices and robust detection of
+// device removal and attachment.  There are probably lots of other
+// issues... this code has really only been used in 2 projects.  If
+// you use it, please report bugs to paul@pjrc.com
 
 
 #include <stdio.h>
@@ -44,6 +49,46 @@
 #endif
 
 
+// Every handle has a lock for reading and another for writing, so
+// one thread can read while another writes, and threads reading (or
+// writing) the same device take turns.
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+#include <windows.h>
+typedef CRITICAL_SECTION rawhid_lock_t;
+#define lock_init(l)	InitializeCriticalSection(l)
+#define lock_free(l)	DeleteCriticalSection(l)
+#define lock(l)		EnterCriticalSection(l)
+#define unlock(l)	LeaveCriticalSection(l)
+#else
+#include <pthread.h>
+typedef pthread_mutex_t rawhid_lock_t;
+#define lock_init(l)	pthread_mutex_init(l, NULL)
+#define lock_free(l)	pthread_mutex_destroy(l)
+#define lock(l)		pthread_mutex_lock(l)
+#define unlock(l)	pthread_mutex_unlock(l)
+#endif
+
+struct rawhid_common {
+	rawhid_lock_t read_lock;
+	rawhid_lock_t write_lock;
+	uint8_t *batch;		// reports gathered by rawhid_dispatch
+};
+
+static void common_init(struct rawhid_common *c)
+{
+	lock_init(&c->read_lock);
+	lock_init(&c->write_lock);
+	c->batch = NULL;
+}
+
+static void common_free(struct rawhid_common *c)
+{
+	lock_free(&c->read_lock);
+	lock_free(&c->write_lock);
+	free(c->batch);
+}
+
+
 /*************************************************************************/
 /**                                                                     **/
 /**                             Linux / FreeBSD                         **/
@@ -55,6 +100,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -71,21 +117,126 @@
 
 
 struct rawhid_struct {
+	struct rawhid_common common;
 	int fd;
 	int name;
 	int isok;
+	int uses_ids;		// reports begin with a report ID byte
+	int input_size;		// largest input report, without report ID
+	int output_size;	// largest output report, 0 if none
+	uint8_t *inbuf;		// one report plus its report ID
+	uint8_t *outbuf;
+};
+
+struct rawhid_desc_info {
+	int usage_page;		// of the first top level collection
+	int usage;
+	int uses_ids;
+	int input_size;
+	int output_size;
 };
 
 
+// Just enough of a report descriptor parser to learn the top level
+// usage, whether report IDs are used, and the largest input and
+// output reports (in bytes, not counting the report ID).
+static void parse_report_descriptor(const uint8_t *d, int len,
+	struct rawhid_desc_info *info)
+{
+	uint32_t global[4][4], page=0, size=0, count=0, id=0, val;
+	int in_bits[256], out_bits[256];
+	int i, n, k, sp=0, depth=0, usage_ext=0;
+	int64_t usage=-1;
+	uint8_t b;
+
+	memset(info, 0, sizeof(struct rawhid_desc_info));
+	memset(in_bits, 0, sizeof(in_bits));
+	memset(out_bits, 0, sizeof(out_bits));
+	info->usage_page = info->usage = -1;
+	i = 0;
+	while (i < len) {
+		b = d[i++];
+		if (b == 0xFE) {
+			// long item, never used for anything we need
+			if (i >= len) break;
+			i += 2 + d[i];
+			continue;
+		}
+		n = b & 3;
+		if (n == 3) n = 4;
+		if (i + n > len) break;
+		val = 0;
+		for (k=n-1; k >= 0; k--) val = (val << 8) | d[i + k];
+		i += n;
+		switch (b & 0xFC) {
+		  case 0x04: page = val; break;			// Usage Page
+		  case 0x74: size = val; break;			// Report Size
+		  case 0x94: count = val; break;		// Report Count
+		  case 0x84:					// Report ID
+			id = val & 255;
+			info->uses_ids = 1;
+			break;
+		  case 0xA4:					// Push
+			if (sp < 4) {
+				global[sp][0] = page;
+				global[sp][1] = size;
+				global[sp][2] = count;
+				global[sp][3] = id;
+				sp++;
+			}
+			break;
+		  case 0xB4:					// Pop
+			if (sp > 0) {
+				sp--;
+				page = global[sp][0];
+				size = global[sp][1];
+				count = global[sp][2];
+				id = global[sp][3];
+			}
+			break;
+		  case 0x08:					// Usage
+			if (usage < 0) {
+				usage = val;
+				usage_ext = (n == 4);	// page in the upper 16 bits
+			}
+			break;
+		  case 0xA0:					// Collection
+			if (depth++ == 0 && info->usage < 0 && usage >= 0) {
+				info->usage_page = usage_ext ? (int)(usage >> 16) : (int)page;
+				info->usage = usage & 0xFFFF;
+			}
+			usage = -1;
+			break;
+		  case 0xC0:					// End Collection
+			if (depth > 0) depth--;
+			break;
+		  case 0x80:					// Input
+			in_bits[id] += size * count;
+			usage = -1;
+			break;
+		  case 0x90:					// Output
+			out_bits[id] += size * count;
+			usage = -1;
+			break;
+		  case 0xB0:					// Feature
+			usage = -1;
+			break;
+		}
+	}
+	for (i=0; i < 256; i++) {
+		if ((in_bits[i] + 7) / 8 > info->input_size) info->input_size = (in_bits[i] + 7) / 8;
+		if ((out_bits[i] + 7) / 8 > info->output_size) info->output_size = (out_bits[i] + 7) / 8;
+	}
+}
+
 rawhid_t * rawhid_open_only1(int vid, int pid, int usage_page, int usage)
 {
 	struct rawhid_struct *hid;
 	struct stat devstat;
 	struct hidraw_devinfo info;
-	struct hidraw_report_descriptor *desc;
-	char buf[512];
-	// TODO; inputs are ignored and hardcoded into this signature....
-	const unsigned char signature[]={0x06,0x31,0xFF,0x09,0x74};
+	struct hidraw_report_descriptor desc;
+	struct rawhid_desc_info desc_info;
+	char buf[64];
 	int r, i, fd=-1, len, found=0;
 
 	//printf("Searching for device using hidraw....\n");
@@ -101,31 +252,48 @@ rawhid_t * rawhid_open_only1(int vid, int pid, int usage_page, int usage)
 		r = ioctl(fd, HIDIOCGRAWINFO, &info);
 		if (r < 0) continue;
 		//printf("  vid=%04X, pid=%04X\n", info.vendor & 0xFFFF, info.product & 0xFFFF);
+		if (vid > 0 && vid != (info.vendor & 0xFFFF)) continue;
+		if (pid > 0 && pid != (info.product & 0xFFFF)) continue;
 		r = ioctl(fd, HIDIOCGRDESCSIZE, &len);
 		if (r < 0 || len < 1) continue;
 		//printf("  len=%u\n", len);
-		desc = (struct hidraw_report_descriptor *)buf;
-		if (len > sizeof(buf)-sizeof(int)) len = sizeof(buf)-sizeof(int);
-		desc->size = len;
-		r = ioctl(fd, HIDIOCGRDESC, desc);
+		if (len > sizeof(desc.value)) len = sizeof(desc.value);
+		desc.size = len;
+		r = ioctl(fd, HIDIOCGRDESC, &desc);
 		if (r < 0) continue;
-		if (len >= sizeof(signature) &&
-		   memcmp(desc->value, signature, sizeof(signature)) == 0) {
-			//printf("  Match\n");
-			found = 1;
-			break;
-		}
+		parse_report_descriptor(desc.value, len, &desc_info);
+		//printf("  usage_page=%04X, usage=%04X\n", desc_info.usage_page, desc_info.usage);
+		if (usage_page > 0 && usage_page != desc_info.usage_page) continue;
+		if (usage > 0 && usage != desc_info.usage) continue;
+		//printf("  Match\n");
+		found = 1;
+		break;
 	}
 	if (!found) {
 		if (fd > 0) close(fd);
 		return NULL;
 	}
 	hid = (struct rawhid_struct *)malloc(sizeof(struct rawhid_struct));
-	if (!hid) {
+	if (desc_info.input_size < 1) desc_info.input_size = 64;
+	if (hid) {
+		hid->inbuf = (uint8_t *)malloc(desc_info.input_size + 1);
+		hid->outbuf = (uint8_t *)malloc(desc_info.output_size + 1);
+	}
+	if (!hid || !hid->inbuf || !hid->outbuf) {
+		if (hid) {
+			free(hid->inbuf);
+			free(hid->outbuf);
+			free(hid);
+		}
 		close(fd);
 		return NULL;
 	}
+	common_init(&hid->common);
 	hid->fd = fd;
+	hid->name = i;
+	hid->uses_ids = desc_info.uses_ids;
+	hid->input_size = desc_info.input_size;
+	hid->output_size = desc_info.output_size;
 	return hid;
 }
 
@@ -135,16 +303,58 @@ int rawhid_status(rawhid_t *hid)
 	return -1;
 }
 
-int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
+int rawhid_report_size(rawhid_t *h)
+{
+	struct rawhid_struct *hid;
+
+	hid = (struct rawhid_struct *)h;
+	if (!hid || hid->fd < 0) return -1;
+	return hid->input_size;
+}
+
+int rawhid_fd(rawhid_t *h)
+{
+	struct rawhid_struct *hid;
+
+	hid = (struct rawhid_struct *)h;
+	if (!hid) return -1;
+	return hid->fd;
+}
+
+static void * thread_attach(struct rawhid_struct *hid)
+{
+	return NULL;
+}
+
+static void thread_detach(struct rawhid_struct *hid, void *prev)
+{
+}
+
+static int read_report(rawhid_t *h, void *buf, int bufsize, int *report_id, int timeout_ms)
 {
 	struct rawhid_struct *hid;
+	struct pollfd pfd;
 	int num;
 
 	hid = (struct rawhid_struct *)h;
 	if (!hid || hid->fd < 0) return -1;
 
 	while (1) {
-		num = read(hid->fd, buf, bufsize);
+		pfd.fd = hid->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		num = poll(&pfd, 1, timeout_ms);
+		if (num < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (num == 0) return 0;
+		if (!(pfd.revents & POLLIN)) return -1;
+		if (hid->uses_ids) {
+			num = read(hid->fd, hid->inbuf, hid->input_size + 1);
+		} else {
+			num = read(hid->fd, buf, bufsize);
+		}
 		if (num < 0) {
 			if (errno == EINTR || errno == EAGAIN) continue;
 			if (errno == EIO) {
@@ -155,18 +365,52 @@ int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
 			return -1;
 		}
 		//printf("read %d bytes\n", num);
+		if (!hid->uses_ids) {
+			if (report_id) *report_id = 0;
+			return num;
+		}
+		// hidraw puts the report ID first, only when IDs are used
+		if (num < 1) continue;
+		if (report_id) *report_id = hid->inbuf[0];
+		num--;
+		if (num > bufsize) num = bufsize;
+		memcpy(buf, hid->inbuf + 1, num);
 		return num;
 	}
 }
 
+static int write_report(rawhid_t *h, int report_id, const void *buf, int len, int timeout_ms)
+{
+	struct rawhid_struct *hid;
+	int r;
+
+	hid = (struct rawhid_struct *)h;
+	if (!hid || hid->fd < 0 || hid->output_size < 1) return -1;
+	if (len > hid->output_size) len = hid->output_size;
+	// hidraw always wants the report ID first, 0 when IDs are not used
+	hid->outbuf[0] = report_id;
+	memcpy(hid->outbuf + 1, buf, len);
+	// timeout_ms is ignored: hidraw always polls as writable, and a
+	// write blocks until the device takes the report or the kernel's
+	// own USB timeout expires
+	while (1) {
+		r = write(hid->fd, hid->outbuf, len + 1);
+		if (r < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+		return (r == len + 1) ? 0 : -1;
+	}
+}
+
 void rawhid_close(rawhid_t *h)
 {
 	struct rawhid_struct *hid;
 
 	hid = (struct rawhid_struct *)h;
-	if (!hid || hid->fd < 0) return;
-	close(hid->fd);
-	hid->fd = -1;
+	if (!hid) return;
+	if (hid->fd >= 0) close(hid->fd);
+	common_free(&hid->common);
+	free(hid->inbuf);
+	free(hid->outbuf);
+	free(hid);
 }
 
 #if 0
@@ -263,14 +507,56 @@ void rawhid_list_close(rawhid_list_t *list)
 
 
 struct rawhid_struct {
+	struct rawhid_common common;
 	IOHIDDeviceRef ref;
+	CFRunLoopRef runloop;	// which thread gets the callbacks
 	int disconnected;
+	int input_size;		// largest input report, without report ID
+	int output_size;	// 0 if the device has no output report
 	uint8_t *buffer;
+	int buffer_size;
 	int buffer_used;
 	int buffer_report_id;
 };
 
 
+static int get_int_property(IOHIDDeviceRef ref, CFStringRef key)
+{
+	CFTypeRef num;
+	int n;
+
+	num = IOHIDDeviceGetProperty(ref, key);
+	if (!num || CFGetTypeID(num) != CFNumberGetTypeID()) return 0;
+	if (!CFNumberGetValue((CFNumberRef)num, kCFNumberIntType, &n)) return 0;
+	return n;
+}
+
+// whether the report descriptor has Report ID items, in which case
+// the report sizes mac os reports include the ID byte
+static int uses_report_ids(IOHIDDeviceRef ref)
+{
+	CFTypeRef desc;
+	const uint8_t *d;
+	int i, n, len;
+
+	desc = IOHIDDeviceGetProperty(ref, CFSTR(kIOHIDReportDescriptorKey));
+	if (!desc || CFGetTypeID(desc) != CFDataGetTypeID()) return 0;
+	d = CFDataGetBytePtr((CFDataRef)desc);
+	len = (int)CFDataGetLength((CFDataRef)desc);
+	for (i=0; i < len; i += 1 + n) {
+		if (d[i] == 0xFE) {
+			// long item
+			n = (i + 1 < len) ? 2 + d[i + 1] : 0;
+			continue;
+		}
+		if ((d[i] & 0xFC) == 0x84) return 1;
+		n = d[i] & 3;
+		if (n == 3) n = 4;
+	}
+	return 0;
+}
+
+
 static void unplug_callback(void *hid, IOReturn ret, void *ref)
 {
 	// This callback can only be called when the "run loop" (managed by macos)
@@ -308,7 +594,7 @@ rawhid_t * rawhid_open_only1(int vid, int pid, int usage_page, int usage)
 	IOHIDDeviceRef device_list[256];
 	uint8_t *buf;
 	struct rawhid_struct *hid;
-	int num_devices;
+	int num_devices, size, input_size, ids;
 
 	// get access to the HID Manager
 	hid_manager = IOHIDManagerCreate(kCFAllocatorDefault, kIOHIDOptionsTypeNone);
@@ -372,31 +658,48 @@ rawhid_t * rawhid_open_only1(int vid, int pid, int usage_page, int usage)
 		printf("HID/macos: error opening device\n");
 		return NULL;
 	}
-	// return this device
+	// return this device, with a buffer for its largest input report
+	// (mac os counts the report ID byte, the other platforms do not)
+	ids = uses_report_ids(device_list[0]);
+	input_size = get_int_property(device_list[0], CFSTR(kIOHIDMaxInputReportSizeKey)) - ids;
+	if (input_size < 1) input_size = 64;
+	size = input_size + ids;
+	if (size < 64) size = 64;
 	hid = (struct rawhid_struct *)malloc(sizeof(struct rawhid_struct));
-	buf = (uint8_t *)malloc(0x1000);
+	buf = (uint8_t *)malloc(size);
 	if (hid == NULL || buf == NULL) {
 		IOHIDDeviceRegisterRemovalCallback(device_list[0], NULL, NULL);
 		IOHIDDeviceClose(device_list[0], kIOHIDOptionsTypeNone);
 		printf("HID/macos: Unable to allocate memory\n");
 		return NULL;
 	}
+	common_init(&hid->common);
 	hid->ref = device_list[0];
+	hid->runloop = CFRunLoopGetCurrent();
 	hid->disconnected = 0;
+	hid->input_size = input_size;
+	hid->output_size = get_int_property(hid->ref, CFSTR(kIOHIDMaxOutputReportSizeKey));
 	hid->buffer = buf;
+	hid->buffer_size = size;
 	hid->buffer_used = 0;
 
 	// register a callback to receive input
-	IOHIDDeviceRegisterInputReportCallback(hid->ref, hid->buffer, 0x1000,
+	IOHIDDeviceRegisterInputReportCallback(hid->ref, hid->buffer, size,
 		input_callback, hid);
 
 
 	// register a callback to find out when it's unplugged
-	IOHIDDeviceScheduleWithRunLoop(hid->ref, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+	IOHIDDeviceScheduleWithRunLoop(hid->ref, hid->runloop, kCFRunLoopDefaultMode);
 	IOHIDDeviceRegisterRemovalCallback(hid->ref, unplug_callback, hid);
 	return hid;
 }
 
+int rawhid_report_size(rawhid_t *hid)
+{
+	if (!hid) return -1;
+	return ((struct rawhid_struct *)hid)->input_size;
+}
+
 int rawhid_status(rawhid_t *hid)
 {
 	if (!hid) return -1;
@@ -420,24 +723,69 @@ void rawhid_close(rawhid_t *hid)
 	ref = ((struct rawhid_struct *)hid)->ref;
 	IOHIDDeviceRegisterRemovalCallback(ref, NULL, NULL);
 	IOHIDDeviceClose(ref, kIOHIDOptionsTypeNone);
+	common_free(&((struct rawhid_struct *)hid)->common);
+	free(((struct rawhid_struct *)hid)->buffer);
 	free(hid);
 }
 
-int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
+int rawhid_fd(rawhid_t *hid)
+{
+	// no file descriptor, use rawhid_thread_start instead
+	return -1;
+}
+
+// HID callbacks only come from the run loop of the thread which
+// reads, so move the device to the current thread's run loop, and
+// back to the previous one when the reader thread is done
+static void * thread_attach(struct rawhid_struct *hid)
+{
+	CFRunLoopRef prev;
+
+	prev = hid->runloop;
+	IOHIDDeviceUnscheduleFromRunLoop(hid->ref, prev, kCFRunLoopDefaultMode);
+	hid->runloop = CFRunLoopGetCurrent();
+	IOHIDDeviceScheduleWithRunLoop(hid->ref, hid->runloop, kCFRunLoopDefaultMode);
+	return (void *)prev;
+}
+
+static void thread_detach(struct rawhid_struct *hid, void *prev)
+{
+	IOHIDDeviceUnscheduleFromRunLoop(hid->ref, hid->runloop, kCFRunLoopDefaultMode);
+	hid->runloop = (CFRunLoopRef)prev;
+	IOHIDDeviceScheduleWithRunLoop(hid->ref, hid->runloop, kCFRunLoopDefaultMode);
+	CFRunLoopWakeUp(hid->runloop);
+}
+
+// numbered reports arrive with their ID as the first byte
+static int take_report(struct rawhid_struct *hid, void *buf, int bufsize, int *report_id)
+{
+	const uint8_t *p;
+	int len;
+
+	p = hid->buffer;
+	len = hid->buffer_used;
+	if (hid->buffer_report_id && len > 0) {
+		p++;
+		len--;
+	}
+	if (report_id) *report_id = hid->buffer_report_id;
+	if (len > bufsize) len = bufsize;
+	memcpy(buf, p, len);
+	hid->buffer_used = 0;
+	return len;
+}
+
+static int read_report(rawhid_t *h, void *buf, int bufsize, int *report_id, int timeout_ms)
 {
 	struct rawhid_struct *hid;
-	int r, len;
+	int r;
 
 	//printf("begin read\n");
 	hid = (struct rawhid_struct *)h;
 	if (!hid || hid->disconnected) return -1;
 	while (CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0, true) == kCFRunLoopRunHandledSource) {
 		if (hid->buffer_used) {
-			len = hid->buffer_used;
-			if (len > bufsize) len = bufsize;
-			memcpy(buf, hid->buffer, len);
-			hid->buffer_used = 0;
-			return len;
+			return take_report(hid, buf, bufsize, report_id);
 		}
 		if (hid->disconnected) {
 			return -1;
@@ -449,11 +797,7 @@ int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
 		return 0;
 	}
 	if (hid->buffer_used) {
-		len = hid->buffer_used;
-		if (len > bufsize) len = bufsize;
-		memcpy(buf, hid->buffer, len);
-		hid->buffer_used = 0;
-		return len;
+		return take_report(hid, buf, bufsize, report_id);
 	}
 	if (hid->disconnected) return -1;
 	return 0;
@@ -463,13 +807,26 @@ int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
 	//return num;
 }
 
-int rawhid_write(rawhid_t *hid, const void *buf, int len, int timeout_ms)
+static int write_report(rawhid_t *hid, int report_id, const void *buf, int len, int timeout_ms)
 {
 	IOReturn ret;
+	uint8_t *p;
 
-	if (((struct rawhid_struct *)hid)->disconnected) return -1;
-	ret = IOHIDDeviceSetReport(((struct rawhid_struct *)hid)->ref,
-		kIOHIDReportTypeOutput, 0, buf, len);
+	if (!hid || ((struct rawhid_struct *)hid)->disconnected) return -1;
+	if (((struct rawhid_struct *)hid)->output_size < 1) return -1;
+	if (report_id == 0) {
+		ret = IOHIDDeviceSetReport(((struct rawhid_struct *)hid)->ref,
+			kIOHIDReportTypeOutput, 0, buf, len);
+	} else {
+		// numbered reports are sent with the ID as the first byte
+		p = (uint8_t *)malloc(len + 1);
+		if (!p) return -1;
+		p[0] = report_id;
+		memcpy(p + 1, buf, len);
+		ret = IOHIDDeviceSetReport(((struct rawhid_struct *)hid)->ref,
+			kIOHIDReportTypeOutput, report_id, p, len + 1);
+		free(p);
+	}
 	if (ret != kIOReturnSuccess) return -1;
 	return 0;
 }
@@ -494,7 +851,12 @@ int rawhid_write(rawhid_t *hid, const void *buf, int len, int timeout_ms)
 // http://msdn.microsoft.com/en-us/library/ms790932.aspx
 
 struct rawhid_struct {
+	struct rawhid_common common;
 	HANDLE handle;
+	int input_size;		// both sizes include the report ID byte,
+	int output_size;	// which Windows always sends and receives
+	uint8_t *inbuf;
+	uint8_t *outbuf;
 };
 
 
@@ -592,6 +954,19 @@ rawhid_t * rawhid_open_only1(int vid, int pid, int usage_page, int usage)
 			continue;
 		}
 		hid->handle = h;
+		hid->input_size = capabilities.InputReportByteLength;
+		hid->output_size = capabilities.OutputReportByteLength;
+		hid->inbuf = (uint8_t *)malloc(hid->input_size);
+		// devices without an output report have an output size of 0
+		hid->outbuf = hid->output_size > 1 ? (uint8_t *)malloc(hid->output_size) : NULL;
+		if (!hid->inbuf || (hid->output_size > 1 && !hid->outbuf)) {
+			CloseHandle(h);
+			free(hid->inbuf);
+			free(hid->outbuf);
+			free(hid);
+			continue;
+		}
+		common_init(&hid->common);
 		return hid;
 	}
 }
@@ -611,14 +986,38 @@ int rawhid_status(rawhid_t *hid)
 	return 0;
 }
 
+int rawhid_report_size(rawhid_t *hid)
+{
+	if (!hid) return -1;
+	return ((struct rawhid_struct *)hid)->input_size - 1;
+}
+
 void rawhid_close(rawhid_t *hid)
 {
 	if (!hid) return;
 	CloseHandle(((struct rawhid_struct *)hid)->handle);
+	common_free(&((struct rawhid_struct *)hid)->common);
+	free(((struct rawhid_struct *)hid)->inbuf);
+	free(((struct rawhid_struct *)hid)->outbuf);
 	free(hid);
 }
 
-int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
+int rawhid_fd(rawhid_t *hid)
+{
+	// no file descriptor, use rawhid_thread_start instead
+	return -1;
+}
+
+static void * thread_attach(struct rawhid_struct *hid)
+{
+	return NULL;
+}
+
+static void thread_detach(struct rawhid_struct *hid, void *prev)
+{
+}
+
+static int read_report(rawhid_t *h, void *buf, int bufsize, int *report_id, int timeout_ms)
 {
 	DWORD num=0, result;
 	BOOL ret;
@@ -633,7 +1032,7 @@ int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
 	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 	if (ov.hEvent == NULL) return -1;
 
-	ret = ReadFile(hid->handle, buf, bufsize, &num, &ov);
+	ret = ReadFile(hid->handle, hid->inbuf, hid->input_size, &num, &ov);
 	if (ret) {
 		//printf("HID/win32:   read success (immediate)\n");
 		r = num;
@@ -651,7 +1050,13 @@ int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
 			} else {
 				//printf("HID/win32:   read timeout, %lx\n", result);
 				CancelIo(hid->handle);
-				r = 0;
+				// wait for the cancel, ov and inbuf are in use until
+				// then, and keep a report which arrived meanwhile
+				if (GetOverlappedResult(hid->handle, &ov, &num, TRUE)) {
+					r = num;
+				} else {
+					r = 0;
+				}
 			}
 		} else {
 			//printf("HID/win32:   read error (immediate)\n");
@@ -659,11 +1064,18 @@ int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
 		}
 	}
 	CloseHandle(ov.hEvent);
+	if (r > 0) {
+		// the report ID byte is always first, 0 if IDs not used
+		if (report_id) *report_id = hid->inbuf[0];
+		r--;
+		if (r > bufsize) r = bufsize;
+		memcpy(buf, hid->inbuf + 1, r);
+	}
 	return r;
 }
 
 
-int rawhid_write(rawhid_t *h, const void *buf, int len, int timeout_ms)
+static int write_report(rawhid_t *h, int report_id, const void *buf, int len, int timeout_ms)
 {
 	DWORD num=0;
 	BOOL ret;
@@ -672,14 +1084,20 @@ int rawhid_write(rawhid_t *h, const void *buf, int len, int timeout_ms)
 	int r;
 
 	hid = (struct rawhid_struct *)h;
-	if (!hid) return -1;
+	if (!hid || hid->output_size < 2) return -1;
 
 	memset(&ov, 0, sizeof(OVERLAPPED));
 	ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
 	if (ov.hEvent == NULL) return -1;
 
-	// first byte is report ID, must be zero if report IDs not used
-	ret = WriteFile(hid->handle, buf, len, &num, &ov);
+	// first byte is report ID, must be zero if report IDs not used,
+	// and Windows insists on writing the full length report
+	if (len > hid->output_size - 1) len = hid->output_size - 1;
+	hid->outbuf[0] = report_id;
+	memcpy(hid->outbuf + 1, buf, len);
+	memset(hid->outbuf + 1 + len, 0, hid->output_size - 1 - len);
+	len = hid->output_size;
+	ret = WriteFile(hid->handle, hid->outbuf, len, &num, &ov);
 	if (ret) {
 		if (num == len) {
 			//printf("HID/win32:   write success (immediate)\n");
@@ -690,7 +1108,13 @@ int rawhid_write(rawhid_t *h, const void *buf, int len, int timeout_ms)
 		}
 	} else {
 		if (GetLastError() == ERROR_IO_PENDING) {
-			if (GetOverlappedResult(hid->handle, &ov, &num, TRUE)) {
+			if (WaitForSingleObject(ov.hEvent, timeout_ms) != WAIT_OBJECT_0) {
+				//printf("HID/win32:   write timeout\n");
+				CancelIo(hid->handle);
+				// wait for the cancel, ov and outbuf are in use until then
+				GetOverlappedResult(hid->handle, &ov, &num, TRUE);
+				r = -1;
+			} else if (GetOverlappedResult(hid->handle, &ov, &num, TRUE)) {
 				if (num == len) {
 					//printf("HID/win32:   write success (delayed)\n");
 					r = 0;
@@ -721,6 +1145,178 @@ int rawhid_write(rawhid_t *h, const void *buf, int len, int timeout_ms)
 #endif
 
 
+/*************************************************************************/
+/**                                                                     **/
+/**                             All Platforms                           **/
+/**                                                                     **/
+/*************************************************************************/
+
+int rawhid_read_id(rawhid_t *h, void *buf, int bufsize, int *report_id, int timeout_ms)
+{
+	struct rawhid_struct *hid;
+	int r;
+
+	hid = (struct rawhid_struct *)h;
+	if (!hid) return -1;
+	lock(&hid->common.read_lock);
+	r = read_report(h, buf, bufsize, report_id, timeout_ms);
+	unlock(&hid->common.read_lock);
+	return r;
+}
+
+int rawhid_write_id(rawhid_t *h, int report_id, const void *buf, int len, int timeout_ms)
+{
+	struct rawhid_struct *hid;
+	int r;
+
+	hid = (struct rawhid_struct *)h;
+	if (!hid) return -1;
+	lock(&hid->common.write_lock);
+	r = write_report(h, report_id, buf, len, timeout_ms);
+	unlock(&hid->common.write_lock);
+	return r;
+}
+
+// The basic read and write only use reports without a report ID, or
+// ID zero, and never see the ID byte on any platform.
+int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms)
+{
+	return rawhid_read_id(h, buf, bufsize, NULL, timeout_ms);
+}
+
+int rawhid_write(rawhid_t *h, const void *buf, int len, int timeout_ms)
+{
+	return rawhid_write_id(h, 0, buf, len, timeout_ms);
+}
+
+// Wait up to timeout_ms for a report, then gather every report which
+// is already waiting (up to RAWHID_BATCH) and give them all to the
+// callback at once.  The reports are only valid during the callback,
+// which must not read from the same device.  Returns the number of
+// reports delivered, or -1 if the device is gone.
+int rawhid_dispatch(rawhid_t *h, rawhid_callback_t callback, void *context, int timeout_ms)
+{
+	struct rawhid_struct *hid;
+	struct rawhid_report reports[RAWHID_BATCH];
+	uint8_t *p;
+	int size, n, r=0, id;
+
+	hid = (struct rawhid_struct *)h;
+	if (!hid || !callback) return -1;
+	size = rawhid_report_size(h);
+	if (size < 1) return -1;
+	lock(&hid->common.read_lock);
+	if (!hid->common.batch) {
+		hid->common.batch = (uint8_t *)malloc(size * RAWHID_BATCH);
+		if (!hid->common.batch) {
+			unlock(&hid->common.read_lock);
+			return -1;
+		}
+	}
+	for (n=0; n < RAWHID_BATCH; n++) {
+		p = hid->common.batch + n * size;
+		r = read_report(h, p, size, &id, n ? 0 : timeout_ms);
+		if (r <= 0) break;
+		reports[n].id = id;
+		reports[n].len = r;
+		reports[n].data = p;
+	}
+	if (n > 0) callback(context, reports, n);
+	unlock(&hid->common.read_lock);
+	if (n == 0 && r < 0) return -1;
+	return n;
+}
+
+
+struct rawhid_thread_struct {
+	rawhid_t *hid;
+	rawhid_callback_t callback;
+	void *context;
+	int stop;
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+static void reader_loop(struct rawhid_thread_struct *t)
+{
+	void *prev;
+
+	prev = thread_attach((struct rawhid_struct *)t->hid);
+	while (!__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE)) {
+		if (rawhid_dispatch(t->hid, t->callback, t->context, 100) < 0) {
+			// a count of -1 tells the application the device is gone
+			t->callback(t->context, NULL, -1);
+			break;
+		}
+	}
+	// plain rawhid_read works again on the thread which started us
+	thread_detach((struct rawhid_struct *)t->hid, prev);
+}
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+static DWORD WINAPI reader_thread(LPVOID arg)
+{
+	reader_loop((struct rawhid_thread_struct *)arg);
+	return 0;
+}
+#else
+static void * reader_thread(void *arg)
+{
+	reader_loop((struct rawhid_thread_struct *)arg);
+	return NULL;
+}
+#endif
+
+// Start a thread which delivers every report to the callback, until
+// rawhid_thread_stop or the device is disconnected.
+rawhid_thread_t * rawhid_thread_start(rawhid_t *hid, rawhid_callback_t callback, void *context)
+{
+	struct rawhid_thread_struct *t;
+
+	if (!hid || !callback) return NULL;
+	t = (struct rawhid_thread_struct *)malloc(sizeof(struct rawhid_thread_struct));
+	if (!t) return NULL;
+	t->hid = hid;
+	t->callback = callback;
+	t->context = context;
+	t->stop = 0;
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+	t->thread = CreateThread(NULL, 0, reader_thread, t, 0, NULL);
+	if (t->thread == NULL) {
+		free(t);
+		return NULL;
+	}
+#else
+	if (pthread_create(&t->thread, NULL, reader_thread, t) != 0) {
+		free(t);
+		return NULL;
+	}
+#endif
+	return t;
+}
+
+// Stop the thread, and wait for it, so the callback will not run again.
+// This must be done before the device is closed.
+void rawhid_thread_stop(rawhid_thread_t *thread)
+{
+	struct rawhid_thread_struct *t;
+
+	t = (struct rawhid_thread_struct *)thread;
+	if (!t) return;
+	__atomic_store_n(&t->stop, 1, __ATOMIC_RELEASE);
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+	WaitForSingleObject(t->thread, INFINITE);
+	CloseHandle(t->thread);
+#else
+	pthread_join(t->thread, NULL);
+#endif
+	free(t);
+}
+
+
 
 
 
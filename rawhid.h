@@ -1,6 +1,10 @@
 #ifndef rawhid_included_h__
 #define rawhid_included_h__
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Raw HID, Basic API
 typedef void rawhid_t;
 rawhid_t * rawhid_open_only1(int vid, int pid, int usage_page, int usage);
@@ -8,6 +12,14 @@ int rawhid_status(rawhid_t *hid);
 int rawhid_read(rawhid_t *h, void *buf, int bufsize, int timeout_ms);
 int rawhid_write(rawhid_t *hid, const void *buf, int len, int timeout_ms);
 void rawhid_close(rawhid_t *h);
+// Only Windows honours the write timeout.  On Linux and Mac, a write
+// blocks until the device takes the report or the system gives up.
+
+
+// Raw HID, Report Size and Report IDs
+int rawhid_report_size(rawhid_t *hid);
+int rawhid_read_id(rawhid_t *h, void *buf, int bufsize, int *report_id, int timeout_ms);
+int rawhid_write_id(rawhid_t *hid, int report_id, const void *buf, int len, int timeout_ms);
 
 
 // Raw HID, Multiple Device API
@@ -20,4 +32,26 @@ void rawhid_list_remove(rawhid_list_t *list, rawhid_t *hid);
 rawhid_t * rawhid_open(rawhid_list_t *list, int index);
 
 
+// Raw HID, Callback API
+struct rawhid_report {
+	int id;
+	int len;
+	const void *data;
+};
+#define RAWHID_BATCH 32
+typedef void (*rawhid_callback_t)(void *context, const struct rawhid_report *reports, int count);
+int rawhid_fd(rawhid_t *hid);
+int rawhid_dispatch(rawhid_t *hid, rawhid_callback_t callback, void *context, int timeout_ms);
+// Handles may be shared by threads, except rawhid_close, which must
+// only be called once no other thread uses the handle: stop its reader
+// thread, and wait for any rawhid_dispatch, read or write to return.
+typedef void rawhid_thread_t;
+rawhid_thread_t * rawhid_thread_start(rawhid_t *hid, rawhid_callback_t callback, void *context);
+void rawhid_thread_stop(rawhid_thread_t *thread);
+
+#ifdef __cplusplus
+}
+#endif
+
+
 #endif
@@ -0,0 +1,281 @@
+/* Low Jitter Real-Time Mode
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// The kernel only queues a small number of reports for each reader,
+// so if hid_listen is descheduled for too long during a burst from
+// the device, reports are lost.  Everything here is opt-in: pinning
+// the reader to one CPU, SCHED_FIFO priority, locking and prefaulting
+// memory, and busy polling the device with an adaptive backoff (spin,
+// then yield, then sleep for exponentially longer times up to 1 ms,
+// starting over whenever a report arrives).
+//
+// To show whether any of this helps, the read loop measures the gap
+// between consecutive reports it takes from the device during a burst
+// (any read which times out ends the burst).  This is measured the
+// same way with and without busy polling, and includes everything
+// which keeps the reader away from the device: processing the report,
+// the read itself, page faults and being descheduled.
+
+
+#define _GNU_SOURCE		// for sched_setaffinity
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "rtmode.h"
+#include "timestamp.h"
+
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+
+// only busy polling is available in this build
+static int busy_poll = 0;
+
+int rtmode_pin_cpu(int cpu)
+{
+	printf("rtmode: CPU pinning not supported on Windows\n");
+	return -1;
+}
+int rtmode_fifo(int priority)
+{
+	printf("rtmode: SCHED_FIFO not supported on Windows\n");
+	return -1;
+}
+int rtmode_lock_memory(void)
+{
+	printf("rtmode: memory locking not supported on Windows\n");
+	return -1;
+}
+void rtmode_busy_poll(int enable) { busy_poll = enable; }
+void rtmode_stats_interval(int seconds) { }
+void rtmode_print_stats(void) { }
+int rtmode_read(rawhid_t *hid, void *buf, int bufsize, int timeout_ms)
+{
+	int num, i;
+
+	if (!busy_poll) return rawhid_read(hid, buf, bufsize, timeout_ms);
+	for (i=0; i < timeout_ms * 10; i++) {
+		num = rawhid_read(hid, buf, bufsize, 0);
+		if (num != 0) return num;
+	}
+	return 0;
+}
+
+#else
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define SPIN_POLLS	2000		// polls before yielding the CPU
+#define YIELD_POLLS	200		// then polls with sched_yield
+#define MAX_BACKOFF_NS	1000000		// longest sleep between polls
+#define PREFAULT_STACK	(256 * 1024)
+
+static int busy_poll = 0;
+static int stats_interval = 0;
+static uint64_t next_stats_ns = 0;
+static uint32_t backoff_ns = 0;		// 0 while still spinning
+static int idle_polls = 0;
+static uint64_t last_report_ns = 0;	// 0 when not in a burst
+
+// gaps between reports, log2 buckets of nanoseconds
+static struct {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t bucket[40];
+} lat;
+
+// reports received, and when the first and last arrived
+static struct {
+	uint64_t reports;
+	uint64_t bytes;
+	uint64_t first;
+	uint64_t last;
+} rx;
+
+
+static void record(int64_t ns)
+{
+	int b = 0;
+
+	if (ns < 0) ns = 0;
+	while (b < 39 && ((uint64_t)ns >> (b + 1))) b++;
+	lat.bucket[b]++;
+	if (lat.count == 0 || (uint64_t)ns < lat.min) lat.min = ns;
+	if ((uint64_t)ns > lat.max) lat.max = ns;
+	lat.sum += ns;
+	lat.count++;
+}
+
+int rtmode_pin_cpu(int cpu)
+{
+#ifdef __linux__
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		printf("rtmode: unable to pin to CPU %d, errno=%d\n", cpu, errno);
+		return -1;
+	}
+	return 0;
+#else
+	printf("rtmode: CPU pinning is only supported on Linux\n");
+	return -1;
+#endif
+}
+
+int rtmode_fifo(int priority)
+{
+	struct sched_param param;
+	int r;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (r != 0) {
+		printf("rtmode: unable to use SCHED_FIFO priority %d, error=%d\n",
+			priority, r);
+		return -1;
+	}
+	return 0;
+}
+
+int rtmode_lock_memory(void)
+{
+	volatile char stack[PREFAULT_STACK];
+
+#ifdef __GLIBC__
+	// keep freed memory, and never mmap new blocks, so buffers
+	// allocated for a new device come from already faulted pages
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+#endif
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		printf("rtmode: unable to lock memory, errno=%d\n", errno);
+		return -1;
+	}
+	// touch the stack the read loop will use, so it is already mapped
+	memset((char *)stack, 0, sizeof(stack));
+	return 0;
+}
+
+void rtmode_busy_poll(int enable)
+{
+	busy_poll = enable;
+}
+
+void rtmode_stats_interval(int seconds)
+{
+	stats_interval = seconds;
+	next_stats_ns = timestamp_ns() + (uint64_t)seconds * 1000000000;
+}
+
+void rtmode_print_stats(void)
+{
+	int i;
+
+	if (rx.reports) {
+		fprintf(stderr, "received: %llu reports, %llu bytes in %.6f sec\n",
+			(unsigned long long)rx.reports, (unsigned long long)rx.bytes,
+			(rx.last - rx.first) / 1e9);
+		memset(&rx, 0, sizeof(rx));
+	}
+	if (lat.count == 0) return;
+	fprintf(stderr, "report gap: n=%llu min=%.1fus avg=%.1fus max=%.1fus\n",
+		(unsigned long long)lat.count, lat.min / 1000.0,
+		(double)lat.sum / lat.count / 1000.0, lat.max / 1000.0);
+	for (i=0; i < 40; i++) {
+		if (!lat.bucket[i]) continue;
+		fprintf(stderr, "  %10.3f - %10.3f us: %llu\n",
+			i ? (double)(1ull << i) / 1000.0 : 0.0,
+			(double)(2ull << i) / 1000.0,
+			(unsigned long long)lat.bucket[i]);
+	}
+	memset(&lat, 0, sizeof(lat));
+}
+
+static int busy_read(rawhid_t *hid, void *buf, int bufsize, uint64_t deadline)
+{
+	struct timespec ts;
+	uint64_t t, want;
+	int num;
+
+	while (1) {
+		num = rawhid_read(hid, buf, bufsize, 0);
+		t = timestamp_ns();
+		if (num != 0) {
+			backoff_ns = 0;
+			idle_polls = 0;
+			return num;
+		}
+		if (t >= deadline) return 0;
+		if (idle_polls < SPIN_POLLS + YIELD_POLLS) {
+			if (idle_polls++ >= SPIN_POLLS) sched_yield();
+			continue;
+		}
+		backoff_ns = backoff_ns ? backoff_ns * 2 : 1000;
+		if (backoff_ns > MAX_BACKOFF_NS) backoff_ns = MAX_BACKOFF_NS;
+		want = backoff_ns;
+		if (t + want > deadline) want = deadline - t;
+		ts.tv_sec = 0;
+		ts.tv_nsec = want;
+		nanosleep(&ts, NULL);
+	}
+}
+
+int rtmode_read(rawhid_t *hid, void *buf, int bufsize, int timeout_ms)
+{
+	uint64_t begin, end;
+	int num;
+
+	begin = timestamp_ns();
+	if (busy_poll) {
+		num = busy_read(hid, buf, bufsize,
+			begin + (uint64_t)timeout_ms * 1000000);
+		end = timestamp_ns();
+	} else {
+		num = rawhid_read(hid, buf, bufsize, timeout_ms);
+		end = timestamp_ns();
+	}
+	if (num > 0) {
+		if (last_report_ns) record(end - last_report_ns);
+		last_report_ns = end;
+		if (rx.reports == 0) rx.first = end;
+		rx.last = end;
+		rx.reports++;
+		rx.bytes += num;
+	} else {
+		last_report_ns = 0;
+	}
+	if (stats_interval && end >= next_stats_ns) {
+		rtmode_print_stats();
+		next_stats_ns = end + (uint64_t)stats_interval * 1000000000;
+	}
+	return num;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef rtmode_included_h__
+#define rtmode_included_h__
+
+#include "rawhid.h"
+
+// Low Jitter Real-Time Mode
+int rtmode_pin_cpu(int cpu);
+int rtmode_fifo(int priority);
+int rtmode_lock_memory(void);
+void rtmode_busy_poll(int enable);
+void rtmode_stats_interval(int seconds);
+int rtmode_read(rawhid_t *hid, void *buf, int bufsize, int timeout_ms);
+void rtmode_print_stats(void);
+
+#endif
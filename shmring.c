@@ -0,0 +1,177 @@
+/* Shared Memory Broadcast Ring
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// This is the writer half of the ring described in shmring.h.  The
+// writer never waits for readers: it always overwrites the oldest
+// slot, and readers that fall behind find out from the sequence
+// numbers and count the records they lost.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "shmring.h"
+#include "timestamp.h"
+
+
+#if (defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+
+// POSIX shared memory is not available in this build
+shmring_t * shmring_open(const char *name, int slots, int max_report)
+{
+	printf("shmring: not supported on Windows\n");
+	return NULL;
+}
+void shmring_publish(shmring_t *ring, uint32_t device_id, const void *buf, int len) { }
+void shmring_close(shmring_t *ring) { }
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+
+struct shmring_struct {
+	struct shmring_header *hdr;
+	uint8_t *base;
+	size_t map_size;
+	char name[256];
+};
+
+
+// returns 1 if the process which created the ring is gone, 0 if it is
+// still running, -1 if unable to tell
+static int stale_ring(const char *name)
+{
+	struct shmring_header *hdr;
+	struct stat st;
+	uint32_t pid;
+	void *p;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return (errno == ENOENT) ? 1 : -1;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct shmring_header)) {
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, sizeof(struct shmring_header), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return -1;
+	hdr = (struct shmring_header *)p;
+	pid = (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) == SHMRING_MAGIC)
+		? hdr->writer_pid : 0;
+	munmap(p, sizeof(struct shmring_header));
+	if (pid == 0) return -1;
+	if (kill((pid_t)pid, 0) == 0 || errno == EPERM) return 0;
+	return 1;
+}
+
+shmring_t * shmring_open(const char *name, int slots, int max_report)
+{
+	struct shmring_struct *ring;
+	uint32_t n, slot_size;
+	void *p;
+	int fd;
+
+	if (strlen(name) >= sizeof(ring->name)) return NULL;
+	for (n=16; n < (uint32_t)slots && n < 0x100000; n <<= 1) ;
+	if (max_report < SHMRING_MIN_REPORT) max_report = SHMRING_MIN_REPORT;
+	if (max_report > 0x10000) max_report = 0x10000;
+	// round slots up to whole cache lines, so writes never share one
+	slot_size = (sizeof(struct shmring_record) + max_report + 63) & ~63;
+	ring = (struct shmring_struct *)malloc(sizeof(struct shmring_struct));
+	if (!ring) return NULL;
+	strcpy(ring->name, name);
+	ring->map_size = sizeof(struct shmring_header) + (size_t)n * slot_size;
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 && errno == EEXIST) {
+		// left behind by a hid_listen which did not exit cleanly,
+		// readers still attached to the old ring keep their own copy
+		if (stale_ring(name) != 1) {
+			printf("shmring: %s is in use by another hid_listen\n", name);
+			free(ring);
+			return NULL;
+		}
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	}
+	if (fd < 0 || ftruncate(fd, ring->map_size) < 0) {
+		printf("shmring: unable to create %s, errno=%d\n", name, errno);
+		if (fd >= 0) close(fd);
+		free(ring);
+		return NULL;
+	}
+	p = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		printf("shmring: unable to map %s, errno=%d\n", name, errno);
+		shm_unlink(name);
+		free(ring);
+		return NULL;
+	}
+	ring->hdr = (struct shmring_header *)p;
+	ring->base = (uint8_t *)p + sizeof(struct shmring_header);
+	// ftruncate gives zeroed memory, so every slot starts with seq 0
+	ring->hdr->version = SHMRING_VERSION;
+	ring->hdr->slots = n;
+	ring->hdr->slot_size = slot_size;
+	ring->hdr->write_seq = 0;
+	ring->hdr->writer_pid = getpid();
+	__atomic_store_n(&ring->hdr->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+	return ring;
+}
+
+void shmring_publish(shmring_t *h, uint32_t device_id, const void *buf, int len)
+{
+	struct shmring_struct *ring;
+	struct shmring_record *rec;
+	uint64_t n, t;
+	int max;
+
+	ring = (struct shmring_struct *)h;
+	if (!ring || len < 0) return;
+	max = ring->hdr->slot_size - sizeof(struct shmring_record);
+	t = timestamp_ns();
+	n = ring->hdr->write_seq;
+	rec = (struct shmring_record *)(ring->base +
+		(size_t)(n & (ring->hdr->slots - 1)) * ring->hdr->slot_size);
+	__atomic_store_n(&rec->seq, n * 2 + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->timestamp_ns = t;
+	rec->device_id = device_id;
+	rec->report_len = len;
+	rec->len = (len > max) ? max : len;
+	memcpy(rec->data, buf, rec->len);
+	__atomic_store_n(&rec->seq, n * 2 + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->hdr->write_seq, n + 1, __ATOMIC_RELEASE);
+}
+
+void shmring_close(shmring_t *h)
+{
+	struct shmring_struct *ring;
+
+	ring = (struct shmring_struct *)h;
+	if (!ring) return;
+	munmap(ring->hdr, ring->map_size);
+	shm_unlink(ring->name);
+	free(ring);
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef shmring_included_h__
+#define shmring_included_h__
+
+// Shared Memory Broadcast Ring
+//
+// hid_listen can publish every report it receives into a named POSIX
+// shared memory object.  There is a single writer and any number of
+// readers, which never write to the shared memory and therefore can
+// not disturb the writer or each other.  Each slot is protected by a
+// sequence lock: the writer makes the slot's seq odd while it copies
+// the report, and even again when it is complete.  A reader checks the
+// seq before and after looking at a slot, so it can use the report
+// directly from the shared memory (zero copy) and still detect when
+// the writer lapped it and overwrote the slot in the meantime.
+//
+// hid_listen creates the ring when the first device is attached, with
+// slots sized for that device's reports.  A later device with larger
+// reports has them truncated, which readers see as len < report_len.
+// A name can only have one writer: hid_listen refuses to replace a
+// ring while the process which created it is still running.
+//
+// Readers only need this header:
+//
+//	shmring_reader_t r;
+//	const struct shmring_record *rec;
+//
+//	if (shmring_reader_open(&r, "/hid_listen") < 0) ...
+//	while (1) {
+//		rec = shmring_reader_peek(&r);
+//		if (!rec) continue;		// nothing new, spin or sleep
+//		... use rec->data, rec->len, rec->timestamp_ns ...
+//		if (!shmring_reader_next(&r, rec)) ...	// torn, discard it
+//	}
+//	shmring_reader_close(&r);
+
+#include <stdint.h>
+
+#define SHMRING_MAGIC		0x474E5248	// "HRNG"
+#define SHMRING_VERSION		2
+#define SHMRING_MIN_REPORT	64	// smallest report size slots can hold
+
+struct shmring_header {
+	uint32_t magic;		// written last, once the ring is ready
+	uint32_t version;
+	uint32_t slots;		// number of slots, always a power of 2
+	uint32_t slot_size;	// bytes per slot, including the record header
+	uint64_t write_seq;	// number of records ever published
+	uint32_t writer_pid;	// the hid_listen publishing to the ring
+	uint32_t reserved1;
+	uint64_t reserved[4];	// pad to one cache line
+};
+
+struct shmring_record {
+	uint64_t seq;		// 2n+1 while writing record n, 2n+2 when done
+	uint64_t timestamp_ns;	// CLOCK_MONOTONIC when the report arrived
+	uint32_t device_id;	// changes every time a device is attached
+	uint32_t len;		// bytes of report data
+	uint32_t report_len;	// more than len if the report was truncated
+	uint32_t reserved;
+	uint8_t data[];
+};
+
+
+// Shared Memory Broadcast Ring, writer side (hid_listen)
+typedef void shmring_t;
+shmring_t * shmring_open(const char *name, int slots, int max_report);
+void shmring_publish(shmring_t *ring, uint32_t device_id, const void *buf, int len);
+void shmring_close(shmring_t *ring);
+
+
+// Shared Memory Broadcast Ring, reader side
+#if !(defined(WIN32) || defined(WINDOWS) || defined(__WINDOWS__))
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+	const struct shmring_header *hdr;
+	const uint8_t *base;	// first slot
+	size_t map_size;
+	uint64_t next;		// seq of the next record to read
+	uint64_t lost;		// records overwritten before we read them
+} shmring_reader_t;
+
+static inline const struct shmring_record *
+shmring_reader_slot(const shmring_reader_t *r, uint64_t n)
+{
+	return (const struct shmring_record *)(r->base +
+		(size_t)(n & (r->hdr->slots - 1)) * r->hdr->slot_size);
+}
+
+// map an existing ring, starting with the next record published
+static inline int shmring_reader_open(shmring_reader_t *r, const char *name)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return -1;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct shmring_header)) {
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return -1;
+	r->hdr = (const struct shmring_header *)p;
+	r->map_size = st.st_size;
+	if (__atomic_load_n(&r->hdr->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC
+	  || r->hdr->version != SHMRING_VERSION
+	  || sizeof(struct shmring_header) + (size_t)r->hdr->slots
+	    * r->hdr->slot_size > r->map_size) {
+		munmap(p, st.st_size);
+		return -1;
+	}
+	r->base = (const uint8_t *)p + sizeof(struct shmring_header);
+	r->next = __atomic_load_n(&r->hdr->write_seq, __ATOMIC_ACQUIRE);
+	r->lost = 0;
+	return 0;
+}
+
+// the next record, in place in shared memory, or NULL if none yet
+static inline const struct shmring_record *
+shmring_reader_peek(shmring_reader_t *r)
+{
+	const struct shmring_record *rec;
+	uint64_t w, s;
+
+	while (1) {
+		w = __atomic_load_n(&r->hdr->write_seq, __ATOMIC_ACQUIRE);
+		if (r->next >= w) return NULL;
+		if (w - r->next > r->hdr->slots) {
+			r->lost += w - r->hdr->slots - r->next;
+			r->next = w - r->hdr->slots;
+		}
+		rec = shmring_reader_slot(r, r->next);
+		s = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		if (s == r->next * 2 + 2) return rec;
+		// the writer already lapped us and is reusing this slot
+		r->lost++;
+		r->next++;
+	}
+}
+
+// finish with a record from peek, returns 0 if it was overwritten
+// while we used it, so anything read from it must be discarded
+static inline int shmring_reader_next(shmring_reader_t *r,
+	const struct shmring_record *rec)
+{
+	uint64_t s;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	s = __atomic_load_n(&rec->seq, __ATOMIC_RELAXED);
+	if (s != r->next * 2 + 2) {
+		r->lost++;
+		r->next++;
+		return 0;
+	}
+	r->next++;
+	return 1;
+}
+
+static inline void shmring_reader_close(shmring_reader_t *r)
+{
+	if (r->hdr) munmap((void *)r->hdr, r->map_size);
+	r->hdr = NULL;
+}
+#endif
+
+#endif
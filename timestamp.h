@@ -0,0 +1,9 @@
+#ifndef timestamp_included_h__
+#define timestamp_included_h__
+
+#include <stdint.h>
+
+// Monotonic time in nanoseconds, from an arbitrary starting point
+uint64_t timestamp_ns(void);
+
+#endif
@@ -0,0 +1,670 @@
+/* Tokenized Binary Log Decoder
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// Printing text on the device costs flash, CPU time and most of the
+// USB bandwidth.  Instead, firmware can send a small id for each
+// printf format string, plus the raw argument bytes, and let the
+// host do the formatting.  These binary reports can be mixed freely
+// with normal text reports.  A binary report begins with the byte
+// TOKENLOG_MARKER (0x1E, ASCII record separator, which debug text
+// never contains), followed by any number of records:
+//
+//   id      2 bytes, little endian, 0 marks the end (padding)
+//   arglen  1 byte, number of argument bytes which follow
+//   args    each argument in the order the format string uses them
+//
+// Records may not span reports.  Arguments are little endian:
+//
+//   %d %i %u %x %X %o %c %p and '*'   4 bytes
+//   the same with "ll" or "j"          8 bytes
+//   %f %F %e %E %g %G %a %A            4 byte float, or 8 byte double with "l"
+//   %s                                 1 length byte, then the characters
+//
+// The dictionary mapping ids to format strings comes either from a
+// text file, with one "id format" pair per line (C escapes allowed,
+// the format optionally in double quotes, # starts a comment), or
+// directly from the firmware ELF file.  In the ELF file, the format
+// strings are placed in a section named "hidlog", which the linker
+// does not need to load into flash, and the id of each string is its
+// offset in that section plus 1.  For example, with gcc:
+//
+//   extern const char __start_hidlog[];
+//   #define HIDLOG_ID(fmt) ({ static const char f[] __attribute__((section("hidlog"), used)) = fmt; f - __start_hidlog + 1; })
+//   #define HIDLOG(fmt, ...) hidlog_send(HIDLOG_ID(fmt), ##__VA_ARGS__)
+//
+// All format strings are parsed once, when the dictionary is loaded,
+// so decoding only walks a short list of precompiled segments.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "tokenlog.h"
+
+#define FLAG_MINUS	0x01
+#define FLAG_PLUS	0x02
+#define FLAG_SPACE	0x04
+#define FLAG_ALT	0x08
+#define FLAG_ZERO	0x10
+#define FLAG_STAR_W	0x20
+#define FLAG_STAR_P	0x40
+
+struct tl_seg {
+	const char *text;	// literal text, or the whole conversion spec
+	uint16_t len;
+	uint8_t conv;		// 0 for literal text
+	uint8_t flags;
+	uint8_t size;		// argument bytes
+	int16_t width;		// -1 when none
+	int16_t prec;		// -1 when none
+};
+
+struct tl_format {
+	int nseg;
+	struct tl_seg seg[];
+};
+
+struct tokenlog_struct {
+	struct tl_format **fmt;	// indexed by id
+	int max_id;
+	int count;
+	char *blob;		// holds the text of every format string
+};
+
+struct tl_out {
+	char *p;
+	char *end;
+};
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                     Format String Compiler                          **/
+/**                                                                     **/
+/*************************************************************************/
+
+static struct tl_format * compile(const char *fmt)
+{
+	struct tl_format *f;
+	struct tl_seg *s;
+	const char *p, *spec;
+	int n, lng;
+
+	// every segment starts at a '%', or follows a conversion
+	n = 1;
+	for (p=fmt; *p; p++) if (*p == '%') n += 2;
+	f = (struct tl_format *)malloc(sizeof(struct tl_format) + n * sizeof(struct tl_seg));
+	if (!f) return NULL;
+	f->nseg = 0;
+	p = fmt;
+	while (*p) {
+		s = &f->seg[f->nseg];
+		memset(s, 0, sizeof(struct tl_seg));
+		s->width = s->prec = -1;
+		if (*p != '%' || p[1] == '%') {
+			// literal text, up to the next conversion
+			s->text = p;
+			if (*p == '%') {
+				p += 2;
+				s->text++;
+				s->len = 1;
+			} else {
+				while (*p && *p != '%') p++;
+				s->len = p - s->text;
+			}
+			f->nseg++;
+			continue;
+		}
+		spec = p++;
+		for (;; p++) {
+			if (*p == '-') s->flags |= FLAG_MINUS;
+			else if (*p == '+') s->flags |= FLAG_PLUS;
+			else if (*p == ' ') s->flags |= FLAG_SPACE;
+			else if (*p == '#') s->flags |= FLAG_ALT;
+			else if (*p == '0') s->flags |= FLAG_ZERO;
+			else break;
+		}
+		if (*p == '*') {
+			s->flags |= FLAG_STAR_W;
+			p++;
+		} else if (*p >= '1' && *p <= '9') {
+			s->width = strtol(p, (char **)&p, 10);
+		}
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				s->flags |= FLAG_STAR_P;
+				p++;
+			} else {
+				s->prec = strtol(p, (char **)&p, 10);
+			}
+		}
+		lng = 0;
+		while (*p && strchr("hlLjzt", *p)) {
+			if (*p == 'l' || *p == 'j' || *p == 'L') lng++;
+			if (*p == 'j') lng++;
+			p++;
+		}
+		s->conv = *p;
+		if (*p) p++;
+		s->text = spec;
+		s->len = p - spec;
+		switch (s->conv) {
+		  case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+			s->size = (lng >= 2) ? 8 : 4;
+			break;
+		  case 'c': case 'p':
+			s->size = 4;
+			break;
+		  case 'f': case 'F': case 'e': case 'E':
+		  case 'g': case 'G': case 'a': case 'A':
+			s->size = lng ? 8 : 4;
+			break;
+		  case 's':
+			break;
+		  default:
+			// not a conversion we know, print it as it is
+			s->conv = 0;
+		}
+		f->nseg++;
+	}
+	return f;
+}
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                        Dictionary Loading                           **/
+/**                                                                     **/
+/*************************************************************************/
+
+static char * read_file(const char *filename, long *size)
+{
+	FILE *fp;
+	char *buf;
+	long len;
+
+	fp = fopen(filename, "rb");
+	if (!fp) return NULL;
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (char *)malloc(len + 1);
+	if (buf && (len < 0 || fread(buf, 1, len, fp) != (size_t)len)) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(fp);
+	if (!buf) return NULL;
+	buf[len] = 0;
+	*size = len;
+	return buf;
+}
+
+static int add_format(struct tokenlog_struct *t, long id, const char *fmt)
+{
+	struct tl_format **list;
+	int n, old;
+
+	if (id < 1 || id > 0xFFFF) return -1;
+	if (!t->fmt || id > t->max_id) {
+		for (n = t->max_id ? t->max_id : 64; n < id; n *= 2) ;
+		if (n > 0xFFFF) n = 0xFFFF;
+		list = (struct tl_format **)realloc(t->fmt, (n + 1) * sizeof(*list));
+		if (!list) return -1;
+		old = t->fmt ? t->max_id + 1 : 0;
+		memset(list + old, 0, (n + 1 - old) * sizeof(*list));
+		t->fmt = list;
+		t->max_id = n;
+	}
+	if (t->fmt[id]) free(t->fmt[id]);
+	else t->count++;
+	t->fmt[id] = compile(fmt);
+	return t->fmt[id] ? 0 : -1;
+}
+
+static uint32_t elf_get(const uint8_t *p, int size)
+{
+	uint32_t n = 0;
+
+	while (size-- > 0) n = (n << 8) | p[size];
+	return n;
+}
+
+// format strings are the "hidlog" section of a little endian ELF file
+static int load_elf(struct tokenlog_struct *t, long size)
+{
+	const uint8_t *elf = (const uint8_t *)t->blob, *sh, *names;
+	uint32_t shoff, shentsize, shnum, shstrndx, i, j, off, len, name, names_size;
+	int is64;
+
+	if (size < 52 || elf[5] != 1) return -1;
+	is64 = (elf[4] == 2);
+	if (is64 && size < 64) return -1;
+	// 64 bit offsets beyond 4 GB cannot be in a file we read into memory
+	if (is64 && elf_get(elf + 44, 4) != 0) return -1;
+	shoff = is64 ? elf_get(elf + 40, 4) : elf_get(elf + 32, 4);
+	shentsize = elf_get(elf + (is64 ? 58 : 46), 2);
+	shnum = elf_get(elf + (is64 ? 60 : 48), 2);
+	shstrndx = elf_get(elf + (is64 ? 62 : 50), 2);
+	// every section header field read below must be inside the header
+	if (shentsize < (uint32_t)(is64 ? 64 : 40)) return -1;
+	if (shstrndx >= shnum || shoff + (uint64_t)shnum * shentsize > (uint64_t)size) return -1;
+	#define SH_OFFSET(s) elf_get((s) + (is64 ? 24 : 16), 4)
+	#define SH_SIZE(s) elf_get((s) + (is64 ? 32 : 20), 4)
+	sh = elf + shoff + shstrndx * shentsize;
+	if (SH_OFFSET(sh) + (uint64_t)SH_SIZE(sh) > (uint64_t)size) return -1;
+	names = elf + SH_OFFSET(sh);
+	names_size = SH_SIZE(sh);
+	for (i=0; i < shnum; i++) {
+		sh = elf + shoff + i * shentsize;
+		name = elf_get(sh, 4);
+		if (name >= names_size || names_size - name < sizeof("hidlog")) continue;
+		if (memcmp(names + name, "hidlog", sizeof("hidlog")) != 0) continue;
+		off = SH_OFFSET(sh);
+		len = SH_SIZE(sh);
+		if (off + (uint64_t)len > (uint64_t)size) return -1;
+		for (j=0; j < len; ) {
+			if (elf[off + j] == 0) {
+				j++;	// alignment padding between strings
+				continue;
+			}
+			if (memchr(elf + off + j, 0, len - j) == NULL) break;
+			add_format(t, j + 1, (const char *)elf + off + j);
+			j += strlen((const char *)elf + off + j) + 1;
+		}
+		return 0;
+	}
+	#undef SH_OFFSET
+	#undef SH_SIZE
+	printf("tokenlog: no \"hidlog\" section in ELF file\n");
+	return -1;
+}
+
+// unescape in place, returns the end of the string
+static char * unescape(char *p, char quote)
+{
+	char *out = p, c;
+
+	while ((c = *p) != 0 && c != quote && c != '\n' && c != '\r') {
+		p++;
+		if (c == '\\' && *p) {
+			c = *p++;
+			switch (c) {
+			  case 'n': c = '\n'; break;
+			  case 'r': c = '\r'; break;
+			  case 't': c = '\t'; break;
+			  case '0': c = 0; break;
+			  case 'x': c = (char)strtol(p, &p, 16); break;
+			}
+			if (c == 0) break;
+		}
+		*out++ = c;
+	}
+	*out = 0;
+	return p;
+}
+
+// one "id format" pair per line
+static int load_map(struct tokenlog_struct *t)
+{
+	char *p, *line, *fmt, quote;
+	long id;
+
+	for (line = t->blob; *line; line = p) {
+		p = line + strcspn(line, "\n");
+		if (*p) *p++ = 0;
+		line += strspn(line, " \t");
+		if (*line == '#' || *line == 0) continue;
+		id = strtol(line, &fmt, 0);
+		if (fmt == line) continue;
+		fmt += strspn(fmt, " \t");
+		quote = 0;
+		if (*fmt == '"') quote = *fmt++;
+		unescape(fmt, quote);
+		if (add_format(t, id, fmt) < 0) {
+			printf("tokenlog: bad id %ld\n", id);
+		}
+	}
+	return 0;
+}
+
+tokenlog_t * tokenlog_open(const char *filename)
+{
+	struct tokenlog_struct *t;
+	long size;
+	int r;
+
+	t = (struct tokenlog_struct *)malloc(sizeof(struct tokenlog_struct));
+	if (!t) return NULL;
+	t->fmt = NULL;
+	t->max_id = 0;
+	t->count = 0;
+	t->blob = read_file(filename, &size);
+	if (!t->blob) {
+		printf("tokenlog: unable to read %s\n", filename);
+		free(t);
+		return NULL;
+	}
+	if (size >= 4 && memcmp(t->blob, "\177ELF", 4) == 0) {
+		r = load_elf(t, size);
+	} else {
+		r = load_map(t);
+	}
+	if (r < 0) {
+		tokenlog_close(t);
+		return NULL;
+	}
+	return t;
+}
+
+int tokenlog_count(tokenlog_t *t)
+{
+	if (!t) return 0;
+	return ((struct tokenlog_struct *)t)->count;
+}
+
+void tokenlog_close(tokenlog_t *h)
+{
+	struct tokenlog_struct *t;
+	int i;
+
+	t = (struct tokenlog_struct *)h;
+	if (!t) return;
+	for (i=0; i <= t->max_id && t->fmt; i++) {
+		if (t->fmt[i]) free(t->fmt[i]);
+	}
+	free(t->fmt);
+	free(t->blob);
+	free(t);
+}
+
+
+/*************************************************************************/
+/**                                                                     **/
+/**                            Formatting                               **/
+/**                                                                     **/
+/*************************************************************************/
+
+static void put(struct tl_out *o, const char *s, int len)
+{
+	if (len > o->end - o->p) len = o->end - o->p;
+	memcpy(o->p, s, len);
+	o->p += len;
+}
+
+static void pad(struct tl_out *o, char c, int len)
+{
+	if (len > o->end - o->p) len = o->end - o->p;
+	if (len <= 0) return;
+	memset(o->p, c, len);
+	o->p += len;
+}
+
+// prefix (sign or 0x), digits, zero fill and space padding
+static void put_field(struct tl_out *o, const struct tl_seg *s, int width,
+	const char *prefix, int plen, const char *digits, int dlen, int zeros)
+{
+	int fill;
+
+	fill = width - plen - zeros - dlen;
+	if (fill > 0 && (s->flags & FLAG_ZERO) && !(s->flags & FLAG_MINUS)) {
+		zeros += fill;
+		fill = 0;
+	}
+	if (fill > 0 && !(s->flags & FLAG_MINUS)) pad(o, ' ', fill);
+	put(o, prefix, plen);
+	pad(o, '0', zeros);
+	put(o, digits, dlen);
+	if (fill > 0 && (s->flags & FLAG_MINUS)) pad(o, ' ', fill);
+}
+
+static int utoa(char *end, uint64_t n, int base, int upper)
+{
+	const char *hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char *p = end;
+
+	if (base == 10) {
+		while (n >= 100) {
+			// two digits per divide
+			int r = n % 100;
+			n /= 100;
+			*--p = '0' + r % 10;
+			*--p = '0' + r / 10;
+		}
+		if (n >= 10) {
+			*--p = '0' + n % 10;
+			n /= 10;
+		}
+		*--p = '0' + n;
+	} else {
+		int shift = (base == 16) ? 4 : 3;
+		do {
+			*--p = hex[n & (base - 1)];
+			n >>= shift;
+		} while (n);
+	}
+	return end - p;
+}
+
+static void put_int(struct tl_out *o, const struct tl_seg *s, int width,
+	int prec, uint64_t n, int neg)
+{
+	char buf[24], prefix[2];
+	int len, plen = 0, base = 10, zeros = 0;
+
+	if (s->conv == 'x' || s->conv == 'X' || s->conv == 'p') base = 16;
+	if (s->conv == 'o') base = 8;
+	if (neg) prefix[plen++] = '-';
+	else if (s->conv == 'd' || s->conv == 'i') {
+		if (s->flags & FLAG_PLUS) prefix[plen++] = '+';
+		else if (s->flags & FLAG_SPACE) prefix[plen++] = ' ';
+	}
+	if (((s->flags & FLAG_ALT) && base == 16 && n) || s->conv == 'p') {
+		prefix[plen++] = '0';
+		prefix[plen++] = (s->conv == 'X') ? 'X' : 'x';
+	}
+	len = utoa(buf + sizeof(buf), n, base, s->conv == 'X');
+	if (prec == 0 && n == 0) len = 0;
+	if (prec > len) zeros = prec - len;
+	// '#' makes the first octal digit a 0, which zero already is
+	if ((s->flags & FLAG_ALT) && base == 8 && !zeros && (n || !len)) zeros = 1;
+	if (prec >= 0) {
+		// a precision turns off zero fill
+		struct tl_seg tmp = *s;
+		tmp.flags &= ~FLAG_ZERO;
+		put_field(o, &tmp, width, prefix, plen, buf + sizeof(buf) - len, len, zeros);
+		return;
+	}
+	put_field(o, s, width, prefix, plen, buf + sizeof(buf) - len, len, zeros);
+}
+
+static void put_float(struct tl_out *o, const struct tl_seg *s, int width,
+	int prec, double v)
+{
+	static const uint32_t pow10[] = {1, 10, 100, 1000, 10000, 100000,
+		1000000, 10000000, 100000000, 1000000000};
+	char buf[48], spec[32], prefix[1];
+	uint64_t whole = 0, frac;
+	double scaled = 0.0, rem = 0.0;
+	int len, plen = 0, neg, n, fprec, room, tie = 0;
+
+	// the default precision only for %f, %a has its own
+	fprec = (prec < 0) ? 6 : prec;
+	neg = signbit(v) != 0;		// -0.0 too
+	if (neg) v = -v;
+	if (v < 1e18) {
+		// printf rounds the exact binary value, so only a digit which
+		// is too close to a tie to be sure about needs the C library
+		whole = (uint64_t)v;
+		scaled = (v - (double)whole) * pow10[fprec < 10 ? fprec : 0];
+		rem = scaled - (double)(uint64_t)scaled;
+		tie = (rem > 0.5 - 1e-6 && rem < 0.5 + 1e-6);
+	}
+	if ((s->conv != 'f' && s->conv != 'F') || fprec > 9 || !(v < 1e18) || tie) {
+		// rare cases, leave them to the C library, writing straight
+		// to the output as %f of a large number can be very long (a
+		// negative precision is the same as none)
+		n = snprintf(spec, sizeof(spec), "%%%s%s%s%s%s*.*%c",
+			(s->flags & FLAG_MINUS) ? "-" : "", (s->flags & FLAG_PLUS) ? "+" : "",
+			(s->flags & FLAG_SPACE) ? " " : "", (s->flags & FLAG_ALT) ? "#" : "",
+			(s->flags & FLAG_ZERO) ? "0" : "", s->conv);
+		room = o->end - o->p;
+		n = snprintf(o->p, room, spec, width, prec, neg ? -v : v);
+		if (n > room - 1) n = (room > 0) ? room - 1 : 0;	// the rest, or '\0'
+		o->p += n;
+		return;
+	}
+	frac = (uint64_t)scaled + (rem > 0.5);
+	if (frac >= pow10[fprec]) {
+		whole++;
+		frac -= pow10[fprec];
+	}
+	len = 0;
+	if (fprec > 0) {
+		n = utoa(buf + sizeof(buf), frac, 10, 0);
+		len = fprec;
+		memset(buf + sizeof(buf) - len, '0', len - n);
+	}
+	if (fprec > 0 || (s->flags & FLAG_ALT)) buf[sizeof(buf) - ++len] = '.';
+	len += utoa(buf + sizeof(buf) - len, whole, 10, 0);
+	if (neg) prefix[plen++] = '-';
+	else if (s->flags & FLAG_PLUS) prefix[plen++] = '+';
+	else if (s->flags & FLAG_SPACE) prefix[plen++] = ' ';
+	put_field(o, s, width, prefix, plen, buf + sizeof(buf) - len, len, 0);
+}
+
+static int get_arg(const uint8_t **p, const uint8_t *end, int size, uint64_t *v)
+{
+	int i;
+
+	if (end - *p < size) return -1;
+	*v = 0;
+	for (i=size-1; i >= 0; i--) *v = (*v << 8) | (*p)[i];
+	*p += size;
+	return 0;
+}
+
+static void expand(struct tl_out *o, const struct tl_format *f,
+	const uint8_t *arg, const uint8_t *end)
+{
+	const struct tl_seg *s;
+	struct tl_seg left;
+	uint64_t v;
+	int i, width, prec, len;
+	union { uint32_t u; float f; } f32;
+	union { uint64_t u; double d; } f64;
+	char c;
+
+	for (i=0; i < f->nseg; i++) {
+		s = &f->seg[i];
+		if (!s->conv) {
+			put(o, s->text, s->len);
+			continue;
+		}
+		width = s->width;
+		prec = s->prec;
+		if (s->flags & FLAG_STAR_W) {
+			if (get_arg(&arg, end, 4, &v) < 0) goto missing;
+			width = (int32_t)v;
+			if (width < 0) {
+				// a negative width is a '-' flag
+				left = *s;
+				left.flags |= FLAG_MINUS;
+				s = &left;
+				width = (width < -0xFFFF) ? 0xFFFF : -width;
+			}
+		}
+		if (s->flags & FLAG_STAR_P) {
+			if (get_arg(&arg, end, 4, &v) < 0) goto missing;
+			prec = (int32_t)v;
+		}
+		switch (s->conv) {
+		  case 's':
+			if (arg >= end || end - arg - 1 < *arg) goto missing;
+			len = *arg++;
+			if (prec >= 0 && prec < len) len = prec;
+			put_field(o, s, width, "", 0, (const char *)arg, len, 0);
+			arg += arg[-1];
+			break;
+		  case 'c':
+			if (get_arg(&arg, end, 4, &v) < 0) goto missing;
+			c = (char)v;
+			put_field(o, s, width, "", 0, &c, 1, 0);
+			break;
+		  case 'd': case 'i':
+			if (get_arg(&arg, end, s->size, &v) < 0) goto missing;
+			if (s->size == 4) v = (uint64_t)(int64_t)(int32_t)v;
+			if ((int64_t)v < 0) put_int(o, s, width, prec, -v, 1);
+			else put_int(o, s, width, prec, v, 0);
+			break;
+		  case 'u': case 'x': case 'X': case 'o': case 'p':
+			if (get_arg(&arg, end, s->size, &v) < 0) goto missing;
+			put_int(o, s, width, prec, v, 0);
+			break;
+		  default:
+			if (get_arg(&arg, end, s->size, &v) < 0) goto missing;
+			if (s->size == 4) {
+				f32.u = (uint32_t)v;
+				put_float(o, s, width, prec, f32.f);
+			} else {
+				f64.u = v;
+				put_float(o, s, width, prec, f64.d);
+			}
+		}
+	}
+	return;
+missing:
+	put(o, "<?>", 3);
+}
+
+// returns the number of chars written to out, or -1 if this report
+// is ordinary text
+int tokenlog_decode(tokenlog_t *h, const void *report, int len, char *out, int outsize)
+{
+	struct tokenlog_struct *t;
+	const uint8_t *p, *end;
+	struct tl_out o;
+	char unknown[40];
+	int id, arglen;
+
+	t = (struct tokenlog_struct *)h;
+	p = (const uint8_t *)report;
+	if (!t || len < 1 || *p != TOKENLOG_MARKER) return -1;
+	end = p + len;
+	p++;
+	o.p = out;
+	o.end = out + outsize;
+	while (end - p >= 3) {
+		id = p[0] | (p[1] << 8);
+		if (id == 0) break;
+		arglen = p[2];
+		p += 3;
+		if (arglen > end - p) arglen = end - p;
+		if (id <= t->max_id && t->fmt[id]) {
+			expand(&o, t->fmt[id], p, p + arglen);
+		} else {
+			put(&o, unknown, snprintf(unknown, sizeof(unknown),
+				"[hidlog: unknown id %d]\n", id));
+		}
+		p += arglen;
+	}
+	return o.p - out;
+}
@@ -0,0 +1,13 @@
+#ifndef tokenlog_included_h__
+#define tokenlog_included_h__
+
+// Tokenized Binary Log Decoder
+#define TOKENLOG_MARKER		0x1E	// first byte of a binary report
+
+typedef void tokenlog_t;
+tokenlog_t * tokenlog_open(const char *filename);
+int tokenlog_count(tokenlog_t *t);
+int tokenlog_decode(tokenlog_t *t, const void *report, int len, char *out, int outsize);
+void tokenlog_close(tokenlog_t *t);
+
+#endif
@@ -0,0 +1,309 @@
+/* Tokenized Binary Log Decoder, Self Check
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// The host side formatting must print exactly what printf would have
+// printed on the device.  This program (make check) builds random
+// format strings with random flags, widths and precisions, encodes
+// random arguments the way firmware would send them, and compares
+// what tokenlog_decode prints with the C library's snprintf.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "tokenlog.h"
+
+#define CHECK_FORMATS	4000
+#define CHECK_VALUES	250
+#define CHECK_SHOW	20	// mismatches to print
+#define CHECK_MAP	"tokenlog_check.tmp"
+
+enum { ARG_INT32, ARG_INT64, ARG_FLOAT, ARG_DOUBLE, ARG_STRING };
+
+struct conv {
+	char fmt[64];
+	int ch;
+	int type;
+	int star_w;
+	int star_p;
+};
+
+struct value {
+	int32_t w;
+	int32_t p;
+	int64_t i;
+	double d;
+	char s[32];
+};
+
+static struct conv conv[CHECK_FORMATS + 1];
+static uint64_t seed = 0x9E3779B97F4A7C15ull;
+
+
+static uint64_t rnd(void)
+{
+	seed ^= seed << 13;	// xorshift64
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed;
+}
+
+static int rnd_range(int lo, int hi)
+{
+	return lo + (int)(rnd() % (uint64_t)(hi - lo + 1));
+}
+
+// a printf format with one conversion, using only the flags which
+// are defined for it
+static void make_conv(struct conv *c)
+{
+	static const char convs[] = "diuxXocsfFeEgGaA";
+	const char *flags;
+	char *p;
+	int ch, i;
+
+	ch = c->ch = convs[rnd() % (sizeof(convs) - 1)];
+	if (strchr("di", ch)) flags = "-+ 0";
+	else if (strchr("uxXo", ch)) flags = "-#0";
+	else if (strchr("cs", ch)) flags = "-";
+	else flags = "-+ #0";
+	p = c->fmt;
+	if (rnd() & 1) p += sprintf(p, "v=");
+	if ((rnd() & 7) == 0) p += sprintf(p, "%%%%");
+	*p++ = '%';
+	for (i=0; flags[i]; i++) {
+		if ((rnd() & 3) == 0) *p++ = flags[i];
+	}
+	c->star_w = c->star_p = 0;
+	switch (rnd() % 4) {
+	  case 0: c->star_w = 1; *p++ = '*'; break;
+	  case 1: p += sprintf(p, "%d", rnd_range(1, 25)); break;
+	}
+	if (ch != 'c') {
+		switch (rnd() % 4) {
+		  case 0: c->star_p = 1; p += sprintf(p, ".*"); break;
+		  case 1: p += sprintf(p, ".%d", rnd_range(0, 14)); break;
+		}
+	}
+	if (strchr("diuxXo", ch)) {
+		c->type = ARG_INT32;
+		if (rnd() & 1) {
+			c->type = ARG_INT64;
+			p += sprintf(p, "ll");
+		}
+	} else if (ch == 'c') {
+		c->type = ARG_INT32;
+	} else if (ch == 's') {
+		c->type = ARG_STRING;
+	} else {
+		c->type = ARG_FLOAT;
+		if (rnd() & 1) {
+			c->type = ARG_DOUBLE;
+			*p++ = 'l';
+		}
+	}
+	*p++ = ch;
+	if (rnd() & 1) p += sprintf(p, "]");
+	*p = 0;
+}
+
+// values near the edges, where formatting goes wrong
+static double make_double(void)
+{
+	static const double special[] = {0.0, 1.0, 0.5, 2.5, 2.25, 0.125,
+		1e-7, 0.9999999, 9.5, 99.95, 1e15, 1e18, 1e19, 1e300};
+	union { uint64_t u; double d; } bits;
+	double v;
+
+	switch (rnd() % 5) {
+	  case 0:
+		bits.u = rnd();
+		return bits.d;	// anything, even NaN and infinity
+	  case 1:
+		v = special[rnd() % (sizeof(special) / sizeof(special[0]))];
+		break;
+	  case 2:
+		v = (double)rnd_range(0, 2000000) / 8.0;	// exact ties
+		break;
+	  default:
+		v = (double)rnd_range(0, 2000000000) / pow(10.0, rnd_range(0, 12));
+	}
+	return (rnd() & 1) ? -v : v;
+}
+
+static void make_value(const struct conv *c, struct value *v)
+{
+	int i, len;
+
+	v->w = rnd_range(-25, 25);
+	v->p = rnd_range(-3, 14);
+	switch (c->type) {
+	  case ARG_INT32:
+	  case ARG_INT64:
+		switch (rnd() % 3) {
+		  case 0: v->i = (int64_t)rnd(); break;
+		  case 1: v->i = rnd_range(-1000, 1000); break;
+		  default: v->i = rnd_range(0, 2) ? 0 : INT64_MIN;
+		}
+		if (c->type == ARG_INT32) v->i = (int32_t)v->i;
+		if (c->ch == 'c') v->i = rnd_range(1, 255);
+		break;
+	  case ARG_FLOAT:
+		v->d = (float)make_double();
+		break;
+	  case ARG_DOUBLE:
+		v->d = make_double();
+		break;
+	  case ARG_STRING:
+		len = rnd_range(0, sizeof(v->s) - 1);
+		for (i=0; i < len; i++) v->s[i] = rnd_range(' ', '~');
+		v->s[len] = 0;
+	}
+}
+
+static uint8_t * put_le(uint8_t *p, uint64_t n, int size)
+{
+	while (size-- > 0) {
+		*p++ = n;
+		n >>= 8;
+	}
+	return p;
+}
+
+// the report firmware would send for this conversion and value
+static int encode(uint8_t *report, int id, const struct conv *c, const struct value *v)
+{
+	union { float f; uint32_t u; } f32;
+	union { double d; uint64_t u; } f64;
+	uint8_t *p;
+	int len;
+
+	report[0] = TOKENLOG_MARKER;
+	report[1] = id;
+	report[2] = id >> 8;
+	p = report + 4;
+	if (c->star_w) p = put_le(p, (uint32_t)v->w, 4);
+	if (c->star_p) p = put_le(p, (uint32_t)v->p, 4);
+	switch (c->type) {
+	  case ARG_INT32: p = put_le(p, (uint64_t)v->i, 4); break;
+	  case ARG_INT64: p = put_le(p, (uint64_t)v->i, 8); break;
+	  case ARG_FLOAT:
+		f32.f = (float)v->d;
+		p = put_le(p, f32.u, 4);
+		break;
+	  case ARG_DOUBLE:
+		f64.d = v->d;
+		p = put_le(p, f64.u, 8);
+		break;
+	  case ARG_STRING:
+		len = strlen(v->s);
+		*p++ = len;
+		memcpy(p, v->s, len);
+		p += len;
+	}
+	report[3] = p - (report + 4);
+	return p - report;
+}
+
+#define EXPECT(arg) \
+	(c->star_w && c->star_p ? snprintf(buf, size, c->fmt, v->w, v->p, arg) \
+	: c->star_w ? snprintf(buf, size, c->fmt, v->w, arg) \
+	: c->star_p ? snprintf(buf, size, c->fmt, v->p, arg) \
+	: snprintf(buf, size, c->fmt, arg))
+
+// what printf makes of the same conversion and value
+static int expect(char *buf, int size, const struct conv *c, const struct value *v)
+{
+	switch (c->type) {
+	  case ARG_INT32: return EXPECT((int)v->i);
+	  case ARG_INT64: return EXPECT((long long)v->i);
+	  case ARG_FLOAT:
+	  case ARG_DOUBLE: return EXPECT(v->d);
+	  default: return EXPECT(v->s);
+	}
+}
+
+static void show(const char *name, const char *s, int len)
+{
+	int i;
+
+	printf("  %s \"", name);
+	for (i=0; i < len; i++) {
+		if (s[i] >= ' ' && s[i] <= '~') putchar(s[i]);
+		else printf("\\x%02X", (uint8_t)s[i]);
+	}
+	printf("\"\n");
+}
+
+
+int main(void)
+{
+	tokenlog_t *t;
+	struct value v;
+	FILE *fp;
+	uint8_t report[128];
+	char got[256], want[256];
+	int id, i, len, glen, wlen;
+	long checked = 0, failed = 0;
+
+	fp = fopen(CHECK_MAP, "w");
+	if (!fp) {
+		printf("tokenlog_check: unable to write %s\n", CHECK_MAP);
+		return 1;
+	}
+	for (id=1; id <= CHECK_FORMATS; id++) {
+		make_conv(&conv[id]);
+		fprintf(fp, "%d \"%s\"\n", id, conv[id].fmt);
+	}
+	fclose(fp);
+	t = tokenlog_open(CHECK_MAP);
+	remove(CHECK_MAP);
+	if (!t) return 1;
+	if (tokenlog_count(t) != CHECK_FORMATS) {
+		printf("tokenlog_check: loaded %d of %d formats\n",
+			tokenlog_count(t), CHECK_FORMATS);
+		return 1;
+	}
+	for (id=1; id <= CHECK_FORMATS; id++) {
+		for (i=0; i < CHECK_VALUES; i++) {
+			make_value(&conv[id], &v);
+			len = encode(report, id, &conv[id], &v);
+			glen = tokenlog_decode(t, report, len, got, sizeof(got));
+			wlen = expect(want, sizeof(want), &conv[id], &v);
+			if (wlen >= (int)sizeof(want)) continue;	// too long for got
+			checked++;
+			if (glen == wlen && memcmp(got, want, wlen) == 0) continue;
+			if (failed++ < CHECK_SHOW) {
+				printf("\"%s\"", conv[id].fmt);
+				if (conv[id].star_w) printf(" width=%d", v.w);
+				if (conv[id].star_p) printf(" precision=%d", v.p);
+				if (conv[id].type == ARG_STRING) printf("\n");
+				else if (conv[id].type <= ARG_INT64) printf(" %lld\n", (long long)v.i);
+				else printf(" %a\n", v.d);
+				show("decoded", got, glen);
+				show("printf ", want, wlen);
+			}
+		}
+	}
+	tokenlog_close(t);
+	printf("tokenlog_check: %ld of %ld conversions differ from printf\n",
+		failed, checked);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+/* uhid Teensy, a virtual Teensy USB debug device for Linux
+ * Copyright 2026, the hid_listen contributors
+ *
+ * You may redistribute this program and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+// This creates a HID device through /dev/uhid which looks like the
+// debug interface of a Teensy, so hid_listen can be run and measured
+// without any hardware.  Once hid_listen opens it, the device sends
+// a burst of reports filled with numbered 16 byte text lines, then
+// disappears.  The report size can be anything up to 4096 bytes, and
+// the reports can be numbered (report ID 1) to check ID handling.
+//
+// With -e, it instead stands in for firmware answering hid_listen's
+// latency probe (-P): every output report is sent straight back as
+// an input report, and a text line is printed every 100 ms so the
+// debug stream can be seen to keep flowing.  It runs until killed.
+// Linux only, and /dev/uhid usually needs root.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <linux/uhid.h>
+
+
+static int uhid_send(int fd, struct uhid_event *ev)
+{
+	if (write(fd, ev, sizeof(struct uhid_event)) != sizeof(struct uhid_event)) {
+		fprintf(stderr, "uhid write failed, errno=%d\n", errno);
+		return -1;
+	}
+	return 0;
+}
+
+static int create(int fd, int size, int numbered)
+{
+	struct uhid_event ev;
+	uint8_t *d;
+	int n = 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	strcpy((char *)ev.u.create2.name, "uhid Teensy debug");
+	d = ev.u.create2.rd_data;
+	d[n++] = 0x06; d[n++] = 0x31; d[n++] = 0xFF;	// Usage Page (0xFF31)
+	d[n++] = 0x09; d[n++] = 0x74;			// Usage (0x74)
+	d[n++] = 0xA1; d[n++] = 0x01;			// Collection (Application)
+	if (numbered) {
+		d[n++] = 0x85; d[n++] = 0x01;		//   Report ID (1)
+	}
+	d[n++] = 0x09; d[n++] = 0x75;			//   Usage (0x75)
+	d[n++] = 0x15; d[n++] = 0x00;			//   Logical Minimum (0)
+	d[n++] = 0x26; d[n++] = 0xFF; d[n++] = 0x00;	//   Logical Maximum (255)
+	d[n++] = 0x75; d[n++] = 0x08;			//   Report Size (8)
+	d[n++] = 0x96; d[n++] = size; d[n++] = size >> 8; //   Report Count (size)
+	d[n++] = 0x81; d[n++] = 0x02;			//   Input (Data, Variable, Absolute)
+	d[n++] = 0x09; d[n++] = 0x76;			//   Usage (0x76)
+	d[n++] = 0x96; d[n++] = size; d[n++] = size >> 8; //   Report Count (size)
+	d[n++] = 0x91; d[n++] = 0x02;			//   Output (Data, Variable, Absolute)
+	d[n++] = 0xC0;					// End Collection
+	ev.u.create2.rd_size = n;
+	ev.u.create2.bus = 0x03;			// BUS_USB
+	ev.u.create2.vendor = 0x16C0;
+	ev.u.create2.product = 0x0479;
+	return uhid_send(fd, &ev);
+}
+
+// wait until some program opens the hidraw device
+static int wait_open(int fd)
+{
+	struct uhid_event ev;
+
+	while (read(fd, &ev, sizeof(ev)) > 0) {
+		if (ev.type == UHID_OPEN) return 0;
+	}
+	return -1;
+}
+
+static int input(int fd, const uint8_t *data, int len, int size, int numbered)
+{
+	struct uhid_event ev;
+	uint8_t *p;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_INPUT2;
+	p = ev.u.input2.data;
+	if (numbered) *p++ = 1;
+	if (len > size) len = size;
+	memcpy(p, data, len);
+	ev.u.input2.size = size + numbered;
+	return uhid_send(fd, &ev);
+}
+
+// send every output report back, with a line of text between them
+static int echo(int fd, int size, int numbered)
+{
+	struct uhid_event ev, reply;
+	struct pollfd pfd;
+	char text[64];
+	int r, tick=0;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (1) {
+		r = poll(&pfd, 1, 100);
+		if (r < 0) return -1;
+		if (r == 0) {
+			r = snprintf(text, sizeof(text), "uhid Teensy echo tick %d\n", tick++);
+			if (input(fd, (uint8_t *)text, r, size, numbered) < 0) return -1;
+			continue;
+		}
+		if (read(fd, &ev, sizeof(ev)) <= 0) return -1;
+		// the first byte is always the report ID, 0 if unnumbered
+		if (ev.type == UHID_OUTPUT && ev.u.output.size > 1) {
+			if (input(fd, ev.u.output.data + 1,
+			  ev.u.output.size - 1, size, numbered) < 0) return -1;
+		} else if (ev.type == UHID_SET_REPORT) {
+			memset(&reply, 0, sizeof(reply));
+			reply.type = UHID_SET_REPORT_REPLY;
+			reply.u.set_report_reply.id = ev.u.set_report.id;
+			if (uhid_send(fd, &reply) < 0) return -1;
+			if (ev.u.set_report.size > 1 && input(fd, ev.u.set_report.data + 1,
+			  ev.u.set_report.size - 1, size, numbered) < 0) return -1;
+		} else if (ev.type == UHID_CLOSE) {
+			tick = 0;
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+	struct uhid_event ev;
+	int fd, i, j, arg, size=64, count=1000, numbered=0, line=0;
+	int echo_mode=0;
+	uint8_t *p;
+	char text[17];
+	double begin, end;
+
+	for (arg=1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "-s") == 0 && arg+1 < argc) {
+			size = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-n") == 0 && arg+1 < argc) {
+			count = atoi(argv[++arg]);
+		} else if (strcmp(argv[arg], "-i") == 0) {
+			numbered = 1;
+		} else if (strcmp(argv[arg], "-e") == 0) {
+			echo_mode = 1;
+		} else {
+			fprintf(stderr, "Usage: uhid_teensy [-s report_size] [-n count] [-i] [-e]\n");
+			return 1;
+		}
+	}
+	if (size < 1 || size > UHID_DATA_MAX - 1) {
+		fprintf(stderr, "report size must be 1 to %d\n", UHID_DATA_MAX - 1);
+		return 1;
+	}
+	fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open /dev/uhid, errno=%d\n", errno);
+		return 1;
+	}
+	if (create(fd, size, numbered) < 0 || wait_open(fd) < 0) return 1;
+	if (echo_mode) return echo(fd, size, numbered) < 0 ? 1 : 0;
+
+	begin = now();
+	for (i=0; i < count; i++) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = UHID_INPUT2;
+		p = ev.u.input2.data;
+		if (numbered) *p++ = 1;
+		for (j=0; j + 16 <= size; j += 16) {
+			snprintf(text, sizeof(text), "%015d\n", line++);
+			memcpy(p + j, text, 16);
+		}
+		// hid_listen drops the zero padding of a partial line
+		ev.u.input2.size = size + numbered;
+		if (uhid_send(fd, &ev) < 0) return 1;
+	}
+	end = now();
+	printf("sent %d reports of %d bytes in %.6f sec\n", count, size, end - begin);
+
+	// give the reader time to drain its queue before we vanish
+	usleep(500000);
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_DESTROY;
+	uhid_send(fd, &ev);
+	close(fd);
+	return 0;
+}